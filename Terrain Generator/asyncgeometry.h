@@ -0,0 +1,119 @@
+#pragma once
+#include "framework.h"
+#include "geometry.h"
+
+int meshUploadSliceKB = 256;		// largest part of a new mesh sent to the GPU in one frame
+
+// Uploads of the meshes built in the background
+struct MeshUploadStats {
+	int flips = 0;
+	int frames = 0;				// frames the last upload was spread over, until the flip
+	double sliceMs = 0;			// render thread time of the last slice
+	double maxSliceMs = 0;		// of the last upload
+};
+
+MeshUploadStats meshUploadStats;
+
+// Geometry with two sets of GPU buffers. Draws use the front set, while a mesh built on another thread
+// is copied into the back set a slice per frame. A fence after the last slice tells when the GPU has
+// the copy, and only then do the sets swap, so the render thread never waits for a whole rebuild.
+class AsyncGeometry : public Geometry {
+	unsigned int vaos[2], vbos[2], ibos[2];
+	int nIdx[2] = { 0, 0 };
+	int front = 0;
+
+	std::vector<VertexData> vertices;		// mesh being uploaded into the back set
+	std::vector<unsigned int> indices;
+	size_t vertexBytesSent = 0, indexBytesSent = 0;
+	bool uploading = false;
+	GLsync fence = nullptr;
+
+protected:
+	// Starts copying a new mesh into the back set, replacing an upload still in progress
+	void beginUpload(std::vector<VertexData>&& _vertices, std::vector<unsigned int>&& _indices) {
+		if (fence != nullptr) glDeleteSync(fence);
+		fence = nullptr;
+		vertices = std::move(_vertices);
+		indices = std::move(_indices);
+		vertexBytesSent = indexBytesSent = 0;
+		uploading = true;
+		meshUploadStats.frames = 0;
+		meshUploadStats.maxSliceMs = 0;
+
+		int back = 1 - front;
+		glBindVertexArray(vaos[back]);
+		glBindBuffer(GL_ARRAY_BUFFER, vbos[back]);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(VertexData), nullptr, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibos[back]);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), nullptr, GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0); // AttArr 0 = POSITION
+		glEnableVertexAttribArray(1); // AttArr 1 = UV
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)offsetof(VertexData, pos));
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)offsetof(VertexData, tex));
+	}
+
+	// Once per frame, sends the next slice of the upload, or swaps the sets when the fence has passed
+	void continueUpload() {
+		if (!uploading) return;
+		auto start = std::chrono::high_resolution_clock::now();
+		int back = 1 - front;
+		if (fence != nullptr) {
+			if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) return;
+			glDeleteSync(fence);
+			fence = nullptr;
+			nIdx[back] = (int)indices.size();
+			front = back;
+			uploading = false;
+			meshUploadStats.flips++;
+			vertices.clear();
+			indices.clear();
+			return;
+		}
+
+		size_t budget = (size_t)max(1, meshUploadSliceKB) * 1024;
+		size_t vertexBytes = vertices.size() * sizeof(VertexData), indexBytes = indices.size() * sizeof(unsigned int);
+		if (vertexBytesSent < vertexBytes) {
+			size_t bytes = min(budget, vertexBytes - vertexBytesSent);
+			glNamedBufferSubData(vbos[back], vertexBytesSent, bytes, (const char*)vertices.data() + vertexBytesSent);
+			vertexBytesSent += bytes;
+			budget -= bytes;
+		}
+		if (budget > 0 && indexBytesSent < indexBytes) {
+			size_t bytes = min(budget, indexBytes - indexBytesSent);
+			glNamedBufferSubData(ibos[back], indexBytesSent, bytes, (const char*)indices.data() + indexBytesSent);
+			indexBytesSent += bytes;
+		}
+		if (vertexBytesSent == vertexBytes && indexBytesSent == indexBytes) {
+			fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			glFlush();
+		}
+
+		meshUploadStats.frames++;
+		meshUploadStats.sliceMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		meshUploadStats.maxSliceMs = max(meshUploadStats.maxSliceMs, meshUploadStats.sliceMs);
+	}
+
+	bool uploadPending() { return uploading; }
+
+	void drawFront() {
+		glBindVertexArray(vaos[front]);
+		glDrawElements(GL_TRIANGLES, nIdx[front], GL_UNSIGNED_INT, nullptr);
+	}
+
+	int frontIndexCount() { return nIdx[front]; }
+
+public:
+	AsyncGeometry() {
+		vaos[0] = vao; vbos[0] = vbo; ibos[0] = ibo;
+		glGenVertexArrays(1, &vaos[1]);
+		glGenBuffers(1, &vbos[1]);
+		glGenBuffers(1, &ibos[1]);
+	}
+
+	~AsyncGeometry() {
+		if (fence != nullptr) glDeleteSync(fence);
+		glDeleteBuffers(1, &vbos[1]);
+		glDeleteBuffers(1, &ibos[1]);
+		glDeleteVertexArrays(1, &vaos[1]);
+	}
+};
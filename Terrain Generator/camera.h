@@ -90,6 +90,10 @@ public:
         wEye = pos;
     }
 
+    float getFov() {
+        return fov;
+    }
+
     vec3 getEyeDir() {
         return wFront;
     }
@@ -102,6 +106,11 @@ public:
         firstMouse = true;
     }
 
+    void setClipPlanes(float _fp, float _bp) {
+        fp = _fp;
+        bp = _bp;
+    }
+
 
 
     mat4 V() {
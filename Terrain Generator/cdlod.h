@@ -0,0 +1,368 @@
+#pragma once
+#include "framework.h"
+#include "geometry.h"
+#include "plane.h"
+#include "terraintexture.h"
+#include "renderstate.h"
+#include "frustum.h"
+
+bool terrainLod = false;
+float lodPixelError = 2.0;		// largest height error of a level on screen, in pixels
+
+const int LOD_PATCH_GRID = 32;			// quads per patch side, even
+const float LOD_MORPH_START = 0.667f;	// fraction of a range where morphing to the next level starts
+
+// Quadtree selection of the last frame
+struct LodStats {
+	int levels = 0;
+	int nodes = 0;				// nodes drawn, whole or in quadrants
+	long long triangles = 0;
+	double selectMs = 0;
+};
+
+LodStats lodStats;
+
+// Min/max height pyramid over a square grid of patches covering the plane. Level 0 holds the leaves
+// and every level up merges 2x2 nodes. Leaf bounds come from the texels under the patch, so that
+// texture filtering stays inside them.
+class PatchBounds {
+public:
+	int levels = 0;
+	std::vector<std::vector<float>> minHeight, maxHeight;		// per level, per node, in world units
+
+	int nodesPerSide(int level) { return 1 << (levels - 1 - level); }
+
+	// leavesPerSide is a power of two
+	void build(const std::vector<vec4>& image, int width, int height, int leavesPerSide, float amplitude) {
+		levels = 1;
+		while ((1 << (levels - 1)) < leavesPerSide) levels++;
+		minHeight.assign(levels, std::vector<float>());
+		maxHeight.assign(levels, std::vector<float>());
+		for (int level = 0; level < levels; level++) {
+			int nodes = nodesPerSide(level);
+			minHeight[level].resize(nodes * nodes);
+			maxHeight[level].resize(nodes * nodes);
+			parallelFor(0, nodes, [&](int ny) {
+				for (int nx = 0; nx < nodes; nx++) {
+					float lo = FLT_MAX, hi = -FLT_MAX;
+					if (level == 0) {
+						int x0 = max(0, (int)floorf((float)nx / nodes * width - 0.5f)), x1 = min(width - 1, (int)ceilf((float)(nx + 1) / nodes * width - 0.5f));
+						int y0 = max(0, (int)floorf((float)ny / nodes * height - 0.5f)), y1 = min(height - 1, (int)ceilf((float)(ny + 1) / nodes * height - 0.5f));
+						for (int y = y0; y <= y1; y++) {
+							for (int x = x0; x <= x1; x++) {
+								lo = min(lo, image[y * width + x].x);
+								hi = max(hi, image[y * width + x].x);
+							}
+						}
+						lo *= amplitude;
+						hi *= amplitude;
+					} else {
+						for (int child = 0; child < 4; child++) {
+							int c = (ny * 2 + child / 2) * nodes * 2 + nx * 2 + child % 2;
+							lo = min(lo, minHeight[level - 1][c]);
+							hi = max(hi, maxHeight[level - 1][c]);
+						}
+					}
+					minHeight[level][ny * nodes + nx] = lo;
+					maxHeight[level][ny * nodes + nx] = hi;
+				}
+			});
+		}
+	}
+};
+
+// Continuous distance-dependent level of detail (CDLOD, Strugar). The terrain is a quadtree over the
+// plane whose nodes are all drawn with the same patch mesh, scaled to the node. Level 0 holds the
+// leaves, with about one vertex per heightmap texel, and every level up halves the density.
+//
+// Every level covers a distance range from the eye, chosen so that the largest height error of the
+// next coarser level, measured on the heightmap, stays below lodPixelError on screen. A node is split
+// while its bounding box reaches into the range of the finer level. Children out of that range are
+// drawn as quadrants of the parent instead. Each range is at least twice the one below, so neighbours
+// differ by at most one level.
+//
+// Over the last third of its range, the vertex shader morphs a patch into the grid of the next coarser
+// level, using the distance of each vertex. Vertices on a border with a coarser node are beyond the
+// range and fully morphed, so they match that node without cracks, and nothing pops when a node changes
+// level. The plane geometry is drawn instead while LOD is off.
+//
+// Subtrees outside the view frustum are skipped during the selection. Children test only the planes
+// their parent straddles, so nothing is tested below a node entirely inside the frustum. The boxes
+// hold both the terrain and the water surface, since both objects draw the same selection.
+class CdlodTerrain : public Geometry {
+	struct Node {
+		float u, v, size;		// corner and size in plane uv
+		int level;
+		int quadrants;			// bit mask, 15 for the whole node
+	};
+
+	Plane* plane;
+	float scale;
+	int levels = 0;
+	int nIdxQuadrant;
+	TerrainTexture* texture = nullptr;
+	float amplitude = 0;
+	PatchBounds bounds;
+	std::vector<float> levelError;								// per level, largest height error in world units
+	std::vector<float> range;									// per level, the last one is unbounded
+	float rangePixelError = 0, rangeFov = 0;
+	std::vector<Node> selection;
+
+	Frustum frustum;
+	float waterMin = 0, waterMax = 0, waveMargin = 0;		// water surface range in world units
+
+	int nodesPerSide(int level) { return bounds.nodesPerSide(level); }
+
+	// Node bounds and level ranges for the current heightmap
+	void build(TerrainTexture* _texture) {
+		texture = _texture;
+		amplitude = terrainAmplitude;
+		texture->download();
+		const std::vector<vec4>& image = texture->getImage();
+		int width = texture->getWidth(), height = texture->getHeight();
+
+		levels = 1;
+		while ((LOD_PATCH_GRID << (levels - 1)) < max(width, height)) levels++;
+		bounds.build(image, width, height, 1 << (levels - 1), amplitude);
+		lodStats.levels = levels;
+
+		// Heights at the vertices of the leaf grid
+		int n = LOD_PATCH_GRID * nodesPerSide(0);
+		std::vector<float> vertexHeight((n + 1) * (n + 1));
+		parallelFor(0, n + 1, [&](int y) {
+			for (int x = 0; x <= n; x++) vertexHeight[y * (n + 1) + x] = texture->sampleHeight((float)x / n, (float)y / n) * amplitude;
+		});
+
+		// Largest height error of every level against the leaf grid, with the coarse grid interpolated
+		// the way the morphed triangles do it
+		std::vector<float> error(levels, 0.0f);
+		for (int level = 1; level < levels; level++) {
+			int step = 1 << level;
+			std::vector<float> rowError(n + 1, 0.0f);
+			parallelFor(0, n + 1, [&](int y) {
+				int y0 = min(y / step * step, n - step), y1 = y0 + step;
+				float ty = (float)(y - y0) / step;
+				for (int x = 0; x <= n; x++) {
+					int x0 = min(x / step * step, n - step), x1 = x0 + step;
+					float tx = (float)(x - x0) / step;
+					float top = vertexHeight[y0 * (n + 1) + x0] + (vertexHeight[y0 * (n + 1) + x1] - vertexHeight[y0 * (n + 1) + x0]) * tx;
+					float bottom = vertexHeight[y1 * (n + 1) + x0] + (vertexHeight[y1 * (n + 1) + x1] - vertexHeight[y1 * (n + 1) + x0]) * tx;
+					rowError[y] = max(rowError[y], fabsf(vertexHeight[y * (n + 1) + x] - (top + (bottom - top) * ty)));
+				}
+			});
+			for (float e : rowError) error[level] = max(error[level], e);
+		}
+
+		levelError = error;
+		rangeFov = 0;
+	}
+
+	// A level may be used from the distance where the error of the next one is below lodPixelError
+	void updateRanges(float fov) {
+		rangePixelError = lodPixelError;
+		rangeFov = fov;
+		float pixelsPerUnit = windowHeight / (2.0f * tanf(radians(fov / 2.0f)));
+		float leafSize = scale / nodesPerSide(0);
+		range.resize(levels);
+		for (int level = 0; level < levels; level++) {
+			if (level == levels - 1) {
+				range[level] = FLT_MAX;
+				break;
+			}
+			range[level] = levelError[level + 1] * pixelsPerUnit / max(lodPixelError, 0.01f);
+			range[level] = max(range[level], level == 0 ? 2.0f * leafSize : 2.0f * range[level - 1]);
+		}
+	}
+
+	// Squared distance from the eye to the bounding box of a node
+	float distance2(const vec3& eye, int level, int nx, int ny) {
+		int nodes = nodesPerSide(level);
+		float size = scale / nodes;
+		float x0 = -0.5f * scale + nx * size, z0 = -0.5f * scale + ny * size;
+		float dx = max(max(x0 - eye.x, eye.x - (x0 + size)), 0.0f);
+		float dz = max(max(z0 - eye.z, eye.z - (z0 + size)), 0.0f);
+		float dy = max(max(bounds.minHeight[level][ny * nodes + nx] - eye.y, eye.y - bounds.maxHeight[level][ny * nodes + nx]), 0.0f);
+		return dx * dx + dy * dy + dz * dz;
+	}
+
+	// Box of a node with the terrain and the water surface, waves move the water sideways as well
+	FrustumTest testNode(PatchBounds& patches, int level, int nx, int ny, int& planeMask) {
+		int nodes = patches.nodesPerSide(level);
+		float size = scale / nodes;
+		float lo = min(patches.minHeight[level][ny * nodes + nx], waterMin);
+		float hi = max(patches.maxHeight[level][ny * nodes + nx], waterMax);
+		vec3 center((nx + 0.5f) * size - 0.5f * scale, 0.5f * (lo + hi), (ny + 0.5f) * size - 0.5f * scale);
+		vec3 extent(0.5f * size + waveMargin, 0.5f * (hi - lo), 0.5f * size + waveMargin);
+		return frustum.test(center, extent, planeMask);
+	}
+
+	// Leaves of a subtree that are not outside the frustum
+	int cullTree(PatchBounds& patches, int level, int nx, int ny, int planeMask) {
+		FrustumTest test = testNode(patches, level, nx, ny, planeMask);
+		if (test == FRUSTUM_OUTSIDE) return 0;
+		if (test == FRUSTUM_INSIDE) return 1 << (2 * level);
+		if (level == 0) return 1;
+		int visible = 0;
+		for (int child = 0; child < 4; child++) visible += cullTree(patches, level - 1, nx * 2 + child % 2, ny * 2 + child / 2, planeMask);
+		return visible;
+	}
+
+	// Selects a node or parts of its subtree, false if the node is beyond the range of its level. A
+	// culled node returns true, so its parent does not draw that quadrant either.
+	bool selectNode(const vec3& eye, int level, int nx, int ny, int planeMask) {
+		if (terrainCulling && planeMask != 0) {
+			cullStats.boxTests++;
+			if (testNode(bounds, level, nx, ny, planeMask) == FRUSTUM_OUTSIDE) {
+				cullStats.culled++;
+				return true;
+			}
+		}
+
+		float d2 = distance2(eye, level, nx, ny);
+		if (level < levels - 1 && d2 > range[level] * range[level]) return false;
+
+		float size = 1.0f / nodesPerSide(level);
+		Node node = { nx * size, ny * size, size, level, 0 };
+		if (level == 0 || d2 > range[level - 1] * range[level - 1]) {
+			node.quadrants = 15;
+		} else {
+			for (int child = 0; child < 4; child++) {
+				if (!selectNode(eye, level - 1, nx * 2 + child % 2, ny * 2 + child / 2, planeMask)) node.quadrants |= 1 << child;
+			}
+		}
+		if (node.quadrants != 0) selection.push_back(node);
+		return true;
+	}
+
+public:
+	CdlodTerrain(Plane* _plane, float _scale) {
+		plane = _plane;
+		scale = _scale;
+
+		// Patch grid points, [0, 1]^2 once divided by the grid size, and the strips ordered by quadrant so that a whole patch is one
+		// draw and every quadrant a contiguous part of it
+		const int N = LOD_PATCH_GRID, H = LOD_PATCH_GRID / 2;
+		nIdxQuadrant = H * ((H + 1) * 2 + 1);
+		std::vector<GridVertex> vtxData((N + 1) * (N + 1));
+		for (int i = 0; i <= N; i++) {
+			for (int j = 0; j <= N; j++) vtxData[i * (N + 1) + j] = { (unsigned short)j, (unsigned short)i };
+		}
+		std::vector<unsigned int> idxData;
+		idxData.reserve(4 * nIdxQuadrant);
+		for (int quadrant = 0; quadrant < 4; quadrant++) {
+			int i0 = quadrant / 2 * H, j0 = quadrant % 2 * H;
+			for (int i = i0; i < i0 + H; i++) {
+				for (int j = j0; j <= j0 + H; j++) {
+					idxData.push_back(i * (N + 1) + j);
+					idxData.push_back((i + 1) * (N + 1) + j);
+				}
+				idxData.push_back(0xFFFFFFFF);
+			}
+		}
+
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, vtxData.size() * sizeof(GridVertex), vtxData.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, idxData.size() * sizeof(unsigned int), idxData.data(), GL_STATIC_DRAW);
+		setVertexFormat(vtxData.data());
+	}
+
+	// Once per frame before drawing, rebuilds the bounds when the terrain changed
+	void select(const RenderState& state, float fov) {
+		if (!terrainLod) return;
+		auto start = std::chrono::high_resolution_clock::now();
+		if (state.terrainTexture != texture || terrainAmplitude != amplitude) build(state.terrainTexture);
+		if (lodPixelError != rangePixelError || fov != rangeFov) updateRanges(fov);
+
+		frustum.update(state.V, state.P);
+		waveMargin = 2.0f * state.waveAmplitude;
+		waterMin = state.waterLevel * amplitude - waveMargin;
+		waterMax = max(state.waterLevel, lakeStats.maxLevel) * amplitude + waveMargin;
+		cullStats.boxTests = 0;
+		cullStats.culled = 0;
+
+		selection.clear();
+		auto cullStart = std::chrono::high_resolution_clock::now();
+		selectNode(state.wEye, levels - 1, 0, 0, FRUSTUM_ALL_PLANES);
+		cullStats.cullMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - cullStart).count();
+		cullStats.visible = (int)selection.size();
+		lodStats.nodes = (int)selection.size();
+		lodStats.selectMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// Culls heightmap texel sized patches against the frustum of the last frame, each patch on its own
+	// and through the bounds pyramid, and prints the average time of both
+	void benchmarkCulling() {
+		if (texture == nullptr) return;
+		int width = texture->getWidth(), height = texture->getHeight();
+		int leaves = 1;
+		while (leaves < max(width, height)) leaves *= 2;
+		PatchBounds texels;
+		texels.build(texture->getImage(), width, height, leaves, amplitude);
+
+		const int runs = 20;
+		int flatVisible = 0, treeVisible = 0;
+		auto start = std::chrono::high_resolution_clock::now();
+		for (int run = 0; run < runs; run++) {
+			flatVisible = 0;
+			for (int ny = 0; ny < leaves; ny++) {
+				for (int nx = 0; nx < leaves; nx++) {
+					int planeMask = FRUSTUM_ALL_PLANES;
+					if (testNode(texels, 0, nx, ny, planeMask) != FRUSTUM_OUTSIDE) flatVisible++;
+				}
+			}
+		}
+		auto flatEnd = std::chrono::high_resolution_clock::now();
+		for (int run = 0; run < runs; run++) treeVisible = cullTree(texels, texels.levels - 1, 0, 0, FRUSTUM_ALL_PLANES);
+		auto treeEnd = std::chrono::high_resolution_clock::now();
+
+		cullStats.benchmarkPatches = leaves * leaves;
+		cullStats.benchmarkFlatMs = std::chrono::duration<double, std::milli>(flatEnd - start).count() / runs;
+		cullStats.benchmarkTreeMs = std::chrono::duration<double, std::milli>(treeEnd - flatEnd).count() / runs;
+		printf("culling %d patches: %d visible, flat %.3f ms, quadtree %.3f ms (%d visible)\n", cullStats.benchmarkPatches,
+			flatVisible, cullStats.benchmarkFlatMs, cullStats.benchmarkTreeMs, treeVisible);
+	}
+
+	void Draw(Shader& shader) {
+		setProgramUniform(shader, "lodPatch", terrainLod ? 1 : 0);
+		if (!terrainLod) {
+			plane->Draw(shader);
+			return;
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		setProgramUniform(shader, "vertexPulling", 0);
+		setProgramUniform(shader, "gridScale", scale);
+		setProgramUniform(shader, "patchGridDim", LOD_PATCH_GRID);
+		setProgramUniform(shader, "vertexGrid", LOD_PATCH_GRID);
+		int patchLocation = shader.uniformLocation("patchRect");
+		int morphLocation = shader.uniformLocation("morphRange");
+
+		glBindVertexArray(vao);
+		glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+		lodStats.triangles = 0;
+		for (const Node& node : selection) {
+			float end = range[node.level];
+			float begin = node.level == 0 ? 0.0f : range[node.level - 1];
+			glUniform3f(patchLocation, (node.u - 0.5f) * scale, (node.v - 0.5f) * scale, node.size * scale);
+			if (node.level == levels - 1) glUniform2f(morphLocation, 1e30f, 2e30f);		// the top level never morphs
+			else glUniform2f(morphLocation, begin + (end - begin) * LOD_MORPH_START, end);
+			if (node.quadrants == 15) {
+				glDrawElements(GL_TRIANGLE_STRIP, 4 * nIdxQuadrant, GL_UNSIGNED_INT, nullptr);
+				geometryStats.drawCalls++;
+			} else {
+				for (int quadrant = 0; quadrant < 4; quadrant++) {
+					if (!(node.quadrants & (1 << quadrant))) continue;
+					glDrawElements(GL_TRIANGLE_STRIP, nIdxQuadrant, GL_UNSIGNED_INT, (void*)(quadrant * nIdxQuadrant * sizeof(unsigned int)));
+					geometryStats.drawCalls++;
+				}
+			}
+			for (int quadrant = 0; quadrant < 4; quadrant++) {
+				if (node.quadrants & (1 << quadrant)) lodStats.triangles += LOD_PATCH_GRID * LOD_PATCH_GRID / 2;
+			}
+		}
+		geometryStats.triangles += lodStats.triangles;
+		geometryStats.drawMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+};
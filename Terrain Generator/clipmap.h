@@ -0,0 +1,227 @@
+#pragma once
+#include "framework.h"
+#include "geometry.h"
+#include "parallel.h"
+#include "terraintexture.h"
+#include "renderstate.h"
+
+bool terrainClipmap = false;
+int clipmapLevels = 6;
+
+const int CLIPMAP_GRID = 128;		// quads per level side, a multiple of 4
+const int CLIPMAP_TEXTURE = 256;	// texels per level side, a power of two above CLIPMAP_GRID
+const int CLIPMAP_MAP_SIZE = 16384;	// finest level texels per side of the whole virtual map
+const int CLIPMAP_MAX_LEVELS = 10;
+
+// Clipmap updates of the last frame
+struct ClipmapStats {
+	int levels = 0;
+	long long texelsUpdated = 0;
+	int uploads = 0;			// rectangles sent with glTextureSubImage3D
+	double updateMs = 0;		// height generation and upload
+	long long triangles = 0;
+};
+
+ClipmapStats clipmapStats;
+
+// Geometry clipmap (Losasso and Hoppe): nested square grids of CLIPMAP_GRID quads centred on the camera,
+// level L with texels 2^L times the heightmap texel. Every level keeps its heights in one layer of an
+// R32F texture array that is addressed toroidally, so when the camera moves a level only computes and
+// uploads the rows and columns that came into view. The heights are those of the TerrainTexture noise,
+// continued over a CLIPMAP_MAP_SIZE square virtual map, and the generated and eroded map is blended in
+// where it covers the terrain.
+//
+// All levels draw the same (G + 1)^2 vertex grid, whose UV is the integer vertex offset in the level.
+// Level 0 draws all of it, the coarser ones a ring around the hole filled by the finer level. The hole
+// sits one texel off centre depending on the camera, so there are four ring index ranges. Near its outer
+// edge a level morphs its heights into those of the coarser level, which hides the T-junctions.
+class Clipmap : public Geometry {
+	struct Level {
+		int originX = 0, originY = 0;		// texel of the level at vertex (0, 0)
+		bool valid = false;
+	};
+
+	float scale;
+	float texelSize = 0;				// world size of a finest level texel
+	unsigned int heightTexture = 0;
+	int textureLevels = 0;
+	const TerrainTexture* texture = nullptr;
+	float centerX = 0, centerY = 0;		// camera in finest level texels
+	Level level[CLIPMAP_MAX_LEVELS];
+	std::vector<float> strip;
+	unsigned int nIdxFull, nIdxRing;
+
+	// Indices of the quads of the grid outside [holeBegin, holeBegin + G / 2) in both directions
+	void addQuads(std::vector<unsigned int>& idxData, int holeX, int holeY) {
+		const int G = CLIPMAP_GRID;
+		for (int i = 0; i < G; i++) {
+			for (int j = 0; j < G; j++) {
+				if (holeX >= 0 && j >= holeX && j < holeX + G / 2 && i >= holeY && i < holeY + G / 2) continue;
+				unsigned int a = i * (G + 1) + j;
+				idxData.insert(idxData.end(), { a, a + G + 1, a + 1, a + 1, a + G + 1, a + G + 2 });
+			}
+		}
+	}
+
+	// Normalized height of a texel of level l, clamped to the virtual map
+	float height(int l, int x, int y) const {
+		int half = CLIPMAP_MAP_SIZE / 2;
+		int tx = min(max(x << l, -half), half - 1);
+		int ty = min(max(y << l, -half), half - 1);
+		float w = (float)texture->getWidth(), h = (float)texture->getHeight();
+		return texture->getHeightNormalized((tx + w / 2) / (w - 1), (ty + h / 2) / (h - 1));
+	}
+
+	// Computes the texels [x0, x1) x [y0, y1) of level l and uploads them, split where the toroidal
+	// addressing wraps around
+	void updateRegion(int l, int x0, int x1, int y0, int y1) {
+		const int T = CLIPMAP_TEXTURE;
+		int w = x1 - x0, h = y1 - y0;
+		if (w <= 0 || h <= 0) return;
+		strip.resize((size_t)w * h);
+		parallelFor(0, h, [&](int i) {
+			for (int j = 0; j < w; j++) strip[(size_t)i * w + j] = height(l, x0 + j, y0 + i);
+		});
+
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+		for (int y = y0; y < y1;) {
+			int yEnd = min(y1, y - (y & (T - 1)) + T);
+			for (int x = x0; x < x1;) {
+				int xEnd = min(x1, x - (x & (T - 1)) + T);
+				glTextureSubImage3D(heightTexture, 0, x & (T - 1), y & (T - 1), l, xEnd - x, yEnd - y, 1, GL_RED, GL_FLOAT,
+					&strip[(size_t)(y - y0) * w + (x - x0)]);
+				clipmapStats.uploads++;
+				x = xEnd;
+			}
+			y = yEnd;
+		}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		clipmapStats.texelsUpdated += (long long)w * h;
+	}
+
+	// Moves level l to the new origin, computing only the columns and rows that are new
+	void updateLevel(int l, int originX, int originY) {
+		const int G = CLIPMAP_GRID;
+		Level& lv = level[l];
+		if (lv.valid && lv.originX == originX && lv.originY == originY) return;
+		if (!lv.valid || abs(originX - lv.originX) > G || abs(originY - lv.originY) > G) {
+			updateRegion(l, originX, originX + G + 1, originY, originY + G + 1);
+		} else {
+			// New columns over the full height, then new rows over the columns that were kept
+			int keptX0 = max(originX, lv.originX), keptX1 = min(originX, lv.originX) + G + 1;
+			if (originX > lv.originX) updateRegion(l, keptX1, originX + G + 1, originY, originY + G + 1);
+			if (originX < lv.originX) updateRegion(l, originX, keptX0, originY, originY + G + 1);
+			if (originY > lv.originY) updateRegion(l, keptX0, keptX1, lv.originY + G + 1, originY + G + 1);
+			if (originY < lv.originY) updateRegion(l, keptX0, keptX1, originY, lv.originY);
+		}
+		lv.originX = originX;
+		lv.originY = originY;
+		lv.valid = true;
+	}
+
+	void createTexture() {
+		if (heightTexture != 0) glDeleteTextures(1, &heightTexture);
+		textureLevels = clipmapLevels;
+		glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &heightTexture);
+		glTextureParameteri(heightTexture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTextureParameteri(heightTexture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTextureStorage3D(heightTexture, 1, GL_R32F, CLIPMAP_TEXTURE, CLIPMAP_TEXTURE, textureLevels);
+		for (Level& lv : level) lv.valid = false;
+	}
+
+public:
+	Clipmap(float _scale) {
+		const int G = CLIPMAP_GRID;
+		scale = _scale;
+
+		std::vector<VertexData> vtxData((G + 1) * (G + 1));
+		for (int i = 0; i <= G; i++) {
+			for (int j = 0; j <= G; j++) {
+				vtxData[i * (G + 1) + j].pos = vec3((float)j, 0, (float)i);
+				vtxData[i * (G + 1) + j].tex = vec2((float)j, (float)i);
+			}
+		}
+
+		// Full grid, then the rings with the hole at G / 4 + (px, py) for parity 00, 10, 01, 11
+		std::vector<unsigned int> idxData;
+		addQuads(idxData, -1, -1);
+		nIdxFull = (unsigned int)idxData.size();
+		for (int p = 0; p < 4; p++) addQuads(idxData, G / 4 + p % 2, G / 4 + p / 2);
+		nIdxRing = (unsigned int)(idxData.size() - nIdxFull) / 4;
+
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, vtxData.size() * sizeof(VertexData), vtxData.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, idxData.size() * sizeof(unsigned int), idxData.data(), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0); // AttArr 0 = POSITION
+		glEnableVertexAttribArray(1); // AttArr 1 = UV
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)offsetof(VertexData, pos));
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)offsetof(VertexData, tex));
+	}
+
+	~Clipmap() {
+		if (heightTexture != 0) glDeleteTextures(1, &heightTexture);
+	}
+
+	// Once per frame before drawing, recentres the levels on the camera. The origin of a level is even
+	// in its own texels, so it lines up with the texels of the coarser level.
+	void update(const RenderState& state) {
+		if (!terrainClipmap) return;
+		auto start = std::chrono::high_resolution_clock::now();
+		if (clipmapLevels != textureLevels || state.terrainTexture != texture) {
+			texture = state.terrainTexture;
+			texelSize = scale / texture->getWidth();
+			createTexture();
+		}
+		clipmapStats.levels = textureLevels;
+		clipmapStats.texelsUpdated = 0;
+		clipmapStats.uploads = 0;
+
+		centerX = state.wEye.x / texelSize - 0.5f;
+		centerY = state.wEye.z / texelSize - 0.5f;
+		int cx = (int)floorf(centerX), cy = (int)floorf(centerY);
+		for (int l = 0; l < textureLevels; l++) {
+			updateLevel(l, ((cx >> (l + 1)) << 1) - CLIPMAP_GRID / 2, ((cy >> (l + 1)) << 1) - CLIPMAP_GRID / 2);
+		}
+		clipmapStats.updateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	void Draw(Shader& shader) {
+		if (texture == nullptr) return;
+		auto start = std::chrono::high_resolution_clock::now();
+		const int G = CLIPMAP_GRID;
+		glBindTextureUnit(2, heightTexture);
+		setProgramUniform(shader, "clipmapHeights", 2);
+		setProgramUniform(shader, "clipGrid", G);
+		setProgramUniform(shader, "clipTextureSize", CLIPMAP_TEXTURE);
+		setProgramUniform(shader, "texelSize", texelSize);
+		setProgramUniform(shader, "gridScale", scale);
+		glUniform2f(shader.uniformLocation("clipCenter"), centerX, centerY);
+		int levelLocation = shader.uniformLocation("clipLevel");
+		int originLocation = shader.uniformLocation("clipOrigin");
+		int coarserLocation = shader.uniformLocation("clipCoarser");
+
+		glBindVertexArray(vao);
+		clipmapStats.triangles = 0;
+		for (int l = 0; l < textureLevels; l++) {
+			glUniform1i(levelLocation, l);
+			glUniform2i(originLocation, level[l].originX, level[l].originY);
+			glUniform1i(coarserLocation, l + 1 < textureLevels ? 1 : 0);
+			if (l == 0) {
+				glDrawElements(GL_TRIANGLES, nIdxFull, GL_UNSIGNED_INT, nullptr);
+				clipmapStats.triangles += nIdxFull / 3;
+			} else {
+				// Offset of the finer level inside this one, in this level's texels
+				int px = level[l - 1].originX / 2 - level[l].originX - G / 4;
+				int py = level[l - 1].originY / 2 - level[l].originY - G / 4;
+				size_t offset = nIdxFull + (size_t)(px + 2 * py) * nIdxRing;
+				glDrawElements(GL_TRIANGLES, nIdxRing, GL_UNSIGNED_INT, (void*)(offset * sizeof(unsigned int)));
+				clipmapStats.triangles += nIdxRing / 3;
+			}
+			geometryStats.drawCalls++;
+		}
+		geometryStats.triangles += clipmapStats.triangles;
+		geometryStats.drawMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+};
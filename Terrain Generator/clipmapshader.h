@@ -0,0 +1,84 @@
+#pragma once
+#include "framework.h"
+#include "terrainshader.h"
+
+// Terrain drawn by the Clipmap geometry. The vertex stage places a grid vertex on the texel of its level
+// and reads the height from the level's layer. The heightmap of TerrainTexture is sampled at the same
+// texel and replaces the clipmap height over the generated map, fading out at its border, so erosion
+// shows in the middle. Near the outer edge of a level the height is morphed into the average of the
+// coarser level texels around the vertex. The fragment stage is the one of TerrainShader, which takes
+// the normal from screen derivatives where the map gradient does not describe the clipmap heights.
+class ClipmapShader : public TerrainShader {
+	const char* clipmapVertexSource = R"(
+		#version 450 core
+		precision highp float;
+
+		#include <uniformblocks>
+
+		layout(binding = 0) uniform sampler2D terrainTexture;
+		uniform sampler2DArray clipmapHeights;
+		uniform float gridScale;
+		uniform float texelSize;		// world size of a finest level texel
+		uniform int   clipGrid;			// quads per level side
+		uniform int   clipTextureSize;
+		uniform int   clipLevel;
+		uniform ivec2 clipOrigin;		// texel of the level at vertex (0, 0)
+		uniform vec2  clipCenter;		// camera in finest level texels
+		uniform int   clipCoarser;		// whether there is a coarser level to morph into
+
+		layout(location = 0) in vec3  vtxPos;
+		layout(location = 1) in vec2  vtxUV;		// vertex offset in the level
+
+		out vec3 wView;             // view in world space
+		out vec3 wLight[8];		    // light dir in world space
+		out vec2 texcoord;
+		out float height;			// Terrain Height
+		out float distance;			// Distance from camera
+
+		vec2 texelPos(int level, ivec2 t) {
+			return (vec2(t * (1 << level)) + 0.5) * texelSize;
+		}
+
+		float levelHeight(int level, ivec2 t) {
+			float h = texelFetch(clipmapHeights, ivec3(t & (clipTextureSize - 1), level), 0).r;
+			vec2 uv = texelPos(level, t) / gridScale + 0.5;
+			float inside = clamp(min(min(uv.x, uv.y), min(1.0 - uv.x, 1.0 - uv.y)) * 16.0, 0.0, 1.0);
+			if (inside > 0.0) h = mix(h, textureLod(terrainTexture, uv, 0.0).r, inside);
+			return h;
+		}
+
+		void main() {
+			ivec2 t = clipOrigin + ivec2(vtxUV);
+			float h = levelHeight(clipLevel, t);
+			if (clipCoarser != 0) {
+				// 1 on the border of the level, which is at least clipGrid / 2 - 2 texels from the camera
+				vec2 d = abs(vec2(t) - clipCenter / float(1 << clipLevel));
+				float width = float(clipGrid) / 10.0;
+				float alpha = clamp((max(d.x, d.y) - (float(clipGrid) / 2.0 - width - 2.0)) / width, 0.0, 1.0);
+				if (alpha > 0.0) {
+					ivec2 a = t >> 1, b = (t + 1) >> 1;
+					float coarse = 0.25 * (levelHeight(clipLevel + 1, a) + levelHeight(clipLevel + 1, ivec2(b.x, a.y)) +
+						levelHeight(clipLevel + 1, ivec2(a.x, b.y)) + levelHeight(clipLevel + 1, b));
+					h = mix(h, coarse, alpha);
+				}
+			}
+			vec2 world = texelPos(clipLevel, t);
+			vec3 vertexPos = vec3(world.x, h * terrainAmplitude, world.y);
+			gl_Position = vec4(vertexPos, 1) * MVP; // to NDC
+			vec4 wPos = vec4(vertexPos, 1) * M;
+			for(int i = 0; i < nLights; i++) {
+				wLight[i] = lights[i].wLightPos.xyz * wPos.w - wPos.xyz * lights[i].wLightPos.w;
+			}
+		    wView  = wEye * wPos.w - wPos.xyz;
+		    texcoord = world / gridScale + 0.5;
+			height = wPos.y;
+			distance = length(wPos.xyz - wEye);
+		}
+	)";
+
+public:
+	ClipmapShader() : TerrainShader(false) {
+		create(clipmapVertexSource, fragmentSource, "fragmentColor");
+		setUniform(1, "derivativeNormals");
+	}
+};
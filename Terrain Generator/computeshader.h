@@ -12,9 +12,13 @@ public:
 
 	unsigned int getId() { return shaderProgramId; }
 
-	void create(const char* const computeShaderSource) {
+	// defines go after the #version line, so the shader shares constants with the C++ side
+	void create(const char* const computeShaderSource, const std::string& defines = "") {
+		std::string source(computeShaderSource);
+		if (!defines.empty()) source.insert(source.find('\n', source.find("#version")) + 1, defines);
+		const char* text = source.c_str();
 		GLuint computeShader = glCreateShader(GL_COMPUTE_SHADER);
-		glShaderSource(computeShader, 1, &computeShaderSource, NULL);
+		glShaderSource(computeShader, 1, &text, NULL);
 		glCompileShader(computeShader);
 
 		shaderProgramId = glCreateProgram();
@@ -27,10 +31,20 @@ public:
 		if (location >= 0) glUniform1i(location, i);
 	}
 
+	void setUniform(const std::string& name, unsigned int u) {
+		int location = glGetUniformLocation(shaderProgramId, name.c_str());;
+		if (location >= 0) glUniform1ui(location, u);
+	}
+
 	void setUniform(const std::string& name, float f) {
 		int location = glGetUniformLocation(shaderProgramId, name.c_str());;
 		if (location >= 0) glUniform1f(location, f);
 	}
 
+	void setUniform(const std::string& name, const vec2& v) {
+		int location = glGetUniformLocation(shaderProgramId, name.c_str());
+		if (location >= 0) glUniform2f(location, v.x, v.y);
+	}
+
 	~ComputeShader() { if (shaderProgramId > 0) glDeleteProgram(shaderProgramId); }
 };
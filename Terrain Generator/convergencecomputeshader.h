@@ -0,0 +1,83 @@
+#pragma once
+#include "framework.h"
+#include "computeshader.h"
+
+bool erosionConvergence = false;
+float erosionConvergenceThreshold = 0.25;		// stop once an iteration changes the map less than this fraction of the first
+
+// Mean absolute height change of the heightmap at image unit 0 since the last snapshot. Every
+// workgroup reduces its 16x16 texels in shared memory and writes one partial sum, and the partial
+// sums are added up on the CPU.
+class ConvergenceComputeShader : ComputeShader {
+	const char* computeShaderSource = R"(
+		#version 450 core
+
+		layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+		layout(rgba32f, binding = 0) uniform readonly image2D heightMap;
+		layout(rgba32f, binding = 1) uniform readonly image2D previous;
+		layout(std430, binding = 0) buffer PartialSums { float partialSums[]; };
+
+		shared float partial[256];
+
+		void main() {
+			ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+			float change = 0.0;
+			if (all(lessThan(p, imageSize(heightMap)))) change = abs(imageLoad(heightMap, p).r - imageLoad(previous, p).r);
+
+			uint i = gl_LocalInvocationIndex;
+			partial[i] = change;
+			barrier();
+			for (uint stride = 128u; stride > 0u; stride >>= 1) {
+				if (i < stride) partial[i] += partial[i + stride];
+				barrier();
+			}
+			if (i == 0u) partialSums[gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x] = partial[0];
+		}
+		)";
+
+	int width, height, groupsX, groupsY;
+	unsigned int snapshotTexture, partialSumBuffer;
+	std::vector<float> partialSums;
+
+public:
+	ConvergenceComputeShader(int _width, int _height) {
+		width = _width;
+		height = _height;
+		groupsX = (width + 15) / 16;
+		groupsY = (height + 15) / 16;
+		create(computeShaderSource);
+
+		glCreateTextures(GL_TEXTURE_2D, 1, &snapshotTexture);
+		glTextureStorage2D(snapshotTexture, 1, GL_RGBA32F, width, height);
+		glCreateBuffers(1, &partialSumBuffer);
+		glNamedBufferStorage(partialSumBuffer, groupsX * groupsY * sizeof(float), nullptr, 0);
+		partialSums.resize(groupsX * groupsY);
+	}
+
+	void Bind() { glUseProgram(getId()); }
+
+	void snapshot(unsigned int texture) {
+		glMemoryBarrier(GL_ALL_BARRIER_BITS);		// no single bit covers copies reading image stores
+		glCopyImageSubData(texture, GL_TEXTURE_2D, 0, 0, 0, 0, snapshotTexture, GL_TEXTURE_2D, 0, 0, 0, 0, width, height, 1);
+	}
+
+	// In normalized height units, waits for the GPU
+	float meanChange() {
+		Bind();
+		glBindImageTexture(1, snapshotTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, partialSumBuffer);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		glDispatchCompute(groupsX, groupsY, 1);
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glGetNamedBufferSubData(partialSumBuffer, 0, partialSums.size() * sizeof(float), partialSums.data());
+
+		double sum = 0.0;
+		for (float partial : partialSums) sum += partial;
+		return (float)(sum / ((double)width * height));
+	}
+
+	~ConvergenceComputeShader() {
+		glDeleteTextures(1, &snapshotTexture);
+		glDeleteBuffers(1, &partialSumBuffer);
+	}
+};
@@ -1,6 +1,9 @@
 #pragma once
 #include "framework.h"
 #include "computeshader.h"
+#include "gputimer.h"
+#include "erosionstats.h"
+#include "convergencecomputeshader.h"
 
 int terrainTextureWidth = 256;
 int terrainTextureHeight = 256;
@@ -10,6 +13,10 @@ int terrainOctaves = 8;
 int terrainSeed = 500;
 
 int erosionIterations = 5;
+int erosionDroplets = 65536;			// per iteration, independent of the texture size
+int erosionDropletsPerDispatch = 32768;		// upper bound, dispatches shrink to fit the time budget
+int erosionMaxLifetime = 512;				// steps before a droplet is dropped
+float erosionDispatchBudget = 20.0;			// GPU milliseconds per dispatch
 float erosionMinVolume = 0.2;
 float erosionDensity = 1.2;
 float erosionDepositionRate = 0.5;
@@ -17,17 +24,45 @@ float erosionEvaporationRate = 0.01;
 float erosionFriction = 0.1;
 bool terrainErosion = true;
 
+enum ErosionMode { EROSION_DROPLETS_GPU, EROSION_PIPES_GPU, EROSION_PIPES_CPU };
+int erosionMode = EROSION_DROPLETS_GPU;
+
 class ErosionComputeShader : ComputeShader {
+	struct Counters {
+		unsigned int dropletSteps, evaporated, outOfBounds, expired;
+		unsigned int lifetimeHistogram[EROSION_HISTOGRAM_BINS];
+	};
+
+	unsigned int counterBuffer;
+	unsigned long long pendingSteps = 0;	// most steps the counters can hold since they were read
+	GpuTimer timers[2];					// dispatches take turns, a timer is read once the next one is queued
+	int timedDroplets[2] = { 0, 0 };	// droplets of the dispatch a timer holds, 0 once it was read
+	int currentTimer = 0;
+	int dropletsPerDispatch = 1024;		// grows or shrinks towards the time budget
+
 	const char* computeShaderSource = R"(
 		#version 450 core
 
-        layout(local_size_x = 8, local_size_y = 4, local_size_z = 1) in;
+        layout(local_size_x = 64, local_size_y = 1, local_size_z = 1) in;
         layout(rgba32f, binding = 0) uniform image2D heightMap;
+        layout(std430, binding = 0) buffer Counters {
+            uint dropletSteps;
+            uint evaporated;
+            uint outOfBounds;
+            uint expired;
+            uint lifetimeHistogram[HISTOGRAM_BINS];     // droplets by steps taken, bins of (maxLifetime + 1) / HISTOGRAM_BINS steps
+        };
 
         // Parameters
         
         uniform float terrainAmplitude;
-        uniform int numIterations;
+        uniform uint dropletOffset;      // index of the first droplet in this dispatch
+        uniform uint dropletCount;       // droplets in this dispatch
+        uniform uint dropletTotal;       // droplets in this iteration
+        uniform uint seed;
+        uniform vec2 spawnOrigin;        // spawn area as a fraction of the map
+        uniform vec2 spawnSize;
+        uniform uint maxLifetime;
         uniform float minParticleVolume;
         uniform float particleDensity;
         uniform float frictionFactor;
@@ -47,58 +82,216 @@ class ErosionComputeShader : ComputeShader {
             return n;
         }
 
+        // Counter-based RNG (PCG hash), the same droplet index always gives the same numbers
+        uvec2 pcg2d(uvec2 v) {
+            v = v * 1664525u + 1013904223u;
+            v.x += v.y * 1664525u;
+            v.y += v.x * 1664525u;
+            v = v ^ (v >> 16u);
+            v.x += v.y * 1664525u;
+            v.y += v.x * 1664525u;
+            v = v ^ (v >> 16u);
+            return v;
+        }
+
+        // R2 low-discrepancy point jittered by up to one point spacing, so spawn points cover the map
+        // evenly at any droplet count and still land between texels. The sequence is summed in 0.32 fixed
+        // point, where the wrap of the uint is the fract, since a float index loses the low bits of the
+        // position once the droplet count reaches the thousands. The top 24 bits convert exactly, below 1.
+        vec2 spawnPosition(uint droplet) {
+            uvec2 point = uvec2(droplet * 0xC13FA9A9u, droplet * 0x91E10DA5u) + 0x80000000u;
+            float spacing = inversesqrt(float(dropletTotal));
+            uvec2 jitter = uvec2(vec2(pcg2d(uvec2(droplet, seed)) >> 8u) * spacing) << 8u;
+            uint halfSpacing = uint(8388608.0 * spacing) << 8u;
+            return vec2((point + jitter - halfSpacing) >> 8u) * (1.0 / 16777216.0);
+        }
+
         void main() {
             ivec2 dimensions = imageSize(heightMap);
-            ivec2 pixelCoords = ivec2(gl_GlobalInvocationID.xy);
+            if (gl_GlobalInvocationID.x >= dropletCount) return;
 
-            for (int iteration = 0; iteration < numIterations; iteration++) {
-                vec2 dropletPosition = vec2(pixelCoords);
-                float dropletVolume = 1.0;
-                vec2 dropletSpeed = vec2(0.0);
-                float dropletSediment = 0.0;
+            vec2 dropletPosition = (spawnOrigin + spawnSize * spawnPosition(dropletOffset + gl_GlobalInvocationID.x)) * vec2(dimensions);
+            float dropletVolume = 1.0;
+            vec2 dropletSpeed = vec2(0.0);
+            float dropletSediment = 0.0;
 
-                while (dropletVolume > minParticleVolume) {
-                    ivec2 intPosition = ivec2(dropletPosition);
-                    vec3 normal = computeSurfaceNormal(intPosition.x, intPosition.y);
+            uint steps = 0;
+            while (dropletVolume > minParticleVolume) {
+                if (steps == maxLifetime) {
+                    atomicAdd(expired, 1u);
+                    break;
+                }
+                steps++;
+                ivec2 intPosition = ivec2(dropletPosition);
+                vec3 normal = computeSurfaceNormal(intPosition.x, intPosition.y);
 
-                    dropletSpeed += vec2(normal.x, normal.z) / (dropletVolume * particleDensity);
-                    dropletPosition += dropletSpeed;
-                    dropletSpeed *= (1.0 - frictionFactor);
+                dropletSpeed += vec2(normal.x, normal.z) / (dropletVolume * particleDensity);
+                dropletPosition += dropletSpeed;
+                dropletSpeed *= (1.0 - frictionFactor);
 
-                    if (dropletPosition.x < 0 || dropletPosition.x > dimensions.x || dropletPosition.y < 0 || dropletPosition.y > dimensions.y) {
-                        break;
-                    }
+                if (dropletPosition.x < 0 || dropletPosition.x > dimensions.x || dropletPosition.y < 0 || dropletPosition.y > dimensions.y) {
+                    atomicAdd(outOfBounds, 1u);
+                    break;
+                }
 
-                    float maxSediment = dropletVolume * length(dropletSpeed) * (imageLoad(heightMap, intPosition).r - imageLoad(heightMap, ivec2(dropletPosition))).r;
-                    maxSediment = max(0.0, maxSediment);
-                    float sedimentDiff = maxSediment - dropletSediment;
+                float maxSediment = dropletVolume * length(dropletSpeed) * (imageLoad(heightMap, intPosition).r - imageLoad(heightMap, ivec2(dropletPosition))).r;
+                maxSediment = max(0.0, maxSediment);
+                float sedimentDiff = maxSediment - dropletSediment;
 
-                    dropletSediment += depositionRate * sedimentDiff;
+                dropletSediment += depositionRate * sedimentDiff;
 
-                    float finalHeight = imageLoad(heightMap, intPosition).r - dropletVolume * depositionRate * sedimentDiff;
-                    imageStore(heightMap, intPosition, vec4(finalHeight));
+                float finalHeight = imageLoad(heightMap, intPosition).r - dropletVolume * depositionRate * sedimentDiff;
+                imageStore(heightMap, intPosition, vec4(finalHeight));
 
-                    dropletVolume *= (1.0 - evaporationRate);
-                }
+                dropletVolume *= (1.0 - evaporationRate);
             }
+            if (dropletVolume <= minParticleVolume) atomicAdd(evaporated, 1u);		// dropped below the minimum volume
+            atomicAdd(dropletSteps, steps);
+            atomicAdd(lifetimeHistogram[min(steps * HISTOGRAM_BINS / (maxLifetime + 1u), HISTOGRAM_BINS - 1u)], 1u);
         }
 		)";
 
+	// Every iteration gets fresh spawn points. Dispatches start small and are resized from the time of
+	// the one before the last, so that no single dispatch runs much longer than the budget and trips
+	// the driver watchdog, while the GPU always has the next one queued.
+	// With a convergence check the loop stops once an iteration changed the map by less than the
+	// threshold times the change of the first one. The change scales with the droplet count and map
+	// detail, the ratio does not.
+	void runIterations(ConvergenceComputeShader* convergence, unsigned int texture) {
+		erosionStats.iterationsPlanned += iterations;
+		float firstChange = 0.0f;
+		for (int iteration = 0; iteration < iterations; iteration++) {
+			auto start = std::chrono::high_resolution_clock::now();
+			if (convergence) {
+				convergence->snapshot(texture);
+				glUseProgram(getId());
+			}
+
+			setUniform("seed", (unsigned int)(seed * 7919 + iteration));
+			for (int first = 0; first < droplets;) {
+				int count = min(dropletsPerDispatch, droplets - first);
+				setUniform("dropletOffset", (unsigned int)first);
+				setUniform("dropletCount", (unsigned int)count);
+				dispatch(count);
+				first += count;
+			}
+			erosionStats.iterationsRun++;
+
+			if (convergence) {
+				float change = convergence->meanChange() * terrainAmplitude;
+				glUseProgram(getId());
+				erosionStats.iterationChange.push_back(change);
+				if (iteration == 0) firstChange = change;
+				else if (change < erosionConvergenceThreshold * firstChange) {
+					double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+					erosionStats.savedMs += (iterations - iteration - 1) * ms;
+					break;
+				}
+			}
+		}
+	}
+
+	// Queues one batch of droplets and reads the GPU time of the batch before it. The counters add
+	// up on the GPU until collectStats, or until they could wrap.
+	void dispatch(int count) {
+		unsigned long long steps = (unsigned long long)count * (erosionMaxLifetime + 1);
+		if (pendingSteps + steps > 0xFFFFFFFFull) collectStats();
+		pendingSteps += steps;
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, counterBuffer);
+
+		timers[currentTimer].begin();
+		glDispatchCompute((count + 63) / 64, 1, 1);
+		timers[currentTimer].end();
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+		timedDroplets[currentTimer] = count;
+		currentTimer = 1 - currentTimer;
+		readTimer(currentTimer);
+	}
+
+	// Adds the time of a timed dispatch to erosionStats and sizes the next dispatches from it
+	void readTimer(int slot) {
+		if (timedDroplets[slot] == 0) return;
+		double ms = timers[slot].elapsedMs();
+		erosionStats.gpuMs += ms;
+		erosionStats.maxDispatchMs = max(erosionStats.maxDispatchMs, ms);
+		erosionStats.dispatches++;
+
+		float scale = ms > 0.0 ? (float)(erosionDispatchBudget / ms) : 2.0f;
+		scale = max(0.25f, min(scale, 2.0f));
+		dropletsPerDispatch = max(64, min((int)(timedDroplets[slot] * scale), erosionDropletsPerDispatch));
+		timedDroplets[slot] = 0;
+	}
+
+	void clearCounters() {
+		unsigned int zero = 0;
+		glClearNamedBufferData(counterBuffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+		pendingSteps = 0;
+	}
+
 public:
-	ErosionComputeShader() { create(computeShaderSource); }
+	int droplets = erosionDroplets;
+	int iterations = erosionIterations;
+	int seed = terrainSeed;
+	vec2 spawnOrigin = vec2(0, 0);
+	vec2 spawnSize = vec2(1, 1);
 
-	void Bind() {
+	ErosionComputeShader() {
+		create(computeShaderSource, "#define HISTOGRAM_BINS " + std::to_string(EROSION_HISTOGRAM_BINS) + "u\n");
+		glCreateBuffers(1, &counterBuffer);
+		glNamedBufferStorage(counterBuffer, sizeof(Counters), nullptr, GL_DYNAMIC_STORAGE_BIT);
+		clearCounters();
+	}
+
+	// Waits for the queued dispatches and adds their times and counters to erosionStats
+	void collectStats() {
+		readTimer(currentTimer);
+		readTimer(1 - currentTimer);
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		Counters counters;
+		glGetNamedBufferSubData(counterBuffer, 0, sizeof(counters), &counters);
+		erosionStats.dropletSteps += counters.dropletSteps;
+		erosionStats.evaporated += counters.evaporated;
+		erosionStats.outOfBounds += counters.outOfBounds;
+		erosionStats.expired += counters.expired;
+		for (int i = 0; i < EROSION_HISTOGRAM_BINS; i++) erosionStats.lifetimeHistogram[i] += counters.lifetimeHistogram[i];
+		clearCounters();
+	}
+
+	// Runs the iterations on the texture bound to image unit 0 without reading anything back, see Bind
+	void erode() {
 		glUseProgram(getId());	// make this program run
 
         setUniform("terrainAmplitude", terrainAmplitude);
-		setUniform("numIterations", erosionIterations);
 		setUniform("minParticleVolume", erosionMinVolume);
 		setUniform("particleDensity", erosionDensity);
 		setUniform("frictionFactor", erosionFriction);
 		setUniform("depositionRate", erosionDepositionRate);
 		setUniform("evaporationRate", erosionEvaporationRate);
 
-		glDispatchCompute(ceil(terrainTextureWidth / 8), ceil(terrainTextureHeight / 4), 1);
+		setUniform("dropletTotal", (unsigned int)droplets);
+		setUniform("maxLifetime", (unsigned int)erosionMaxLifetime);
+		setUniform("spawnOrigin", spawnOrigin);
+		setUniform("spawnSize", spawnSize);
+		erosionStats.lifetimeBinWidth = (erosionMaxLifetime + 1.0f) / EROSION_HISTOGRAM_BINS;
+
+		if (erosionConvergence) {
+			// Measure the change on whatever texture is bound to image unit 0
+			int texture = 0, width = 0, height = 0;
+			glGetIntegeri_v(GL_IMAGE_BINDING_NAME, 0, &texture);
+			glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_WIDTH, &width);
+			glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_HEIGHT, &height);
+			ConvergenceComputeShader convergence(width, height);
+			runIterations(&convergence, texture);
+		} else {
+			runIterations(nullptr, 0);
+		}
 		glMemoryBarrier(GL_ALL_BARRIER_BITS);
 	}
+
+	void Bind() {
+		erode();
+		collectStats();
+	}
+
+	~ErosionComputeShader() { glDeleteBuffers(1, &counterBuffer); }
 };
@@ -0,0 +1,52 @@
+#pragma once
+#include "framework.h"
+#include <ctime>
+
+const int EROSION_HISTOGRAM_BINS = 32;
+
+// Measurements of the last erosion run, shown in the settings panel
+struct ErosionStats {
+	// Settings the run was made with
+	int mode = 0;
+	int width = 0, height = 0;
+	int droplets = 0, iterations = 0, levels = 0;
+	int tiles = 0;						// 0 when the map was eroded as a whole
+
+	int iterationsPlanned = 0;			// summed over levels and tiles
+	int iterationsRun = 0;
+	double savedMs = 0;					// skipped iterations times the time of the last one run
+	std::vector<float> iterationChange;	// mean |height change| of every iteration run, with convergence checks on
+
+	double totalMs = 0;					// wall clock time of the whole erosion chain
+	double gpuMs = 0;					// sum of the timestamp queries around the droplet dispatches
+	double maxDispatchMs = 0;
+	int dispatches = 0;
+	unsigned long long dropletSteps = 0;
+	unsigned long long evaporated = 0;	// droplets whose volume fell below the minimum
+	unsigned long long outOfBounds = 0;	// droplets that left the map
+	unsigned long long expired = 0;		// droplets that reached the maximum lifetime
+
+	float lifetimeBinWidth = 1;			// steps per histogram bin
+	unsigned long long lifetimeHistogram[EROSION_HISTOGRAM_BINS] = {};
+
+	void reset() { *this = ErosionStats(); }
+
+	// Appends the run as one line to a CSV file, writing the header if the file is new
+	bool exportCSV(const char* path) {
+		FILE* file = fopen(path, "r");
+		bool exists = file != nullptr;
+		if (exists) fclose(file);
+
+		file = fopen(path, "a");
+		if (file == nullptr) return false;
+		if (!exists) fprintf(file, "time,mode,width,height,droplets,iterations,levels,tiles,iterations_planned,iterations_run,saved_ms,total_ms,gpu_ms,max_dispatch_ms,dispatches,droplet_steps,evaporated,out_of_bounds,expired,lifetime_bin_width,lifetime_histogram\n");
+		fprintf(file, "%lld,%d,%d,%d,%d,%d,%d,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%d,%llu,%llu,%llu,%llu,%.2f,", (long long)time(nullptr), mode, width, height,
+			droplets, iterations, levels, tiles, iterationsPlanned, iterationsRun, savedMs, totalMs, gpuMs, maxDispatchMs, dispatches, dropletSteps, evaporated, outOfBounds, expired, lifetimeBinWidth);
+		for (int i = 0; i < EROSION_HISTOGRAM_BINS; i++) fprintf(file, i == 0 ? "%llu" : ";%llu", lifetimeHistogram[i]);
+		fprintf(file, "\n");
+		fclose(file);
+		return true;
+	}
+};
+
+ErosionStats erosionStats;
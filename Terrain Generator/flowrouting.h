@@ -0,0 +1,131 @@
+#pragma once
+#include "framework.h"
+#include "parallel.h"
+#include <atomic>
+
+bool flowRouting = true;
+bool flowRivers = false;			// tint cells with a large upstream area
+float flowRiverThreshold = 100;		// upstream cells where the tint starts
+
+const unsigned char FLOW_NONE = 255;	// pits, flats and cells draining off the map
+const int flowOffsetX[8] = { 1, 1, 0, -1, -1, -1, 0, 1 };
+const int flowOffsetY[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+
+// Timings of the last flow routing run, per stage
+struct FlowStats {
+	double directionMs = 0;
+	double dependencyMs = 0;
+	double accumulationMs = 0;
+	double uploadMs = 0;
+	float maxAccumulation = 0;
+};
+
+FlowStats flowStats;
+
+// D8 flow routing: every cell drains to its steepest downhill neighbour, and the accumulation of a
+// cell is its own area plus the accumulation of all cells draining into it. Each cell keeps a count of
+// donors that are not finished yet. Walks start at cells without donors and go downstream. The walk
+// that finishes the last donor of a cell sums that cell and carries on, and the other walks stop there.
+// Every cell is summed exactly once, after all of its donors, so the work is linear in the map area.
+// The walks are independent and run in parallel. A cell is always summed over its donors in the same
+// order, so the result does not depend on the thread timing.
+class FlowRouting {
+	int width, height;
+	std::vector<std::atomic<unsigned char>> pending;	// donors not summed yet
+
+	int downstream(int i) {
+		unsigned char d = direction[i];
+		if (d == FLOW_NONE) return -1;
+		return (i / width + flowOffsetY[d]) * width + i % width + flowOffsetX[d];
+	}
+
+	void findDirection(const std::vector<vec4>& image, int x, int y) {
+		float h = image[y * width + x].x;
+		float steepest = 0.0f;
+		unsigned char best = FLOW_NONE;
+		for (unsigned char d = 0; d < 8; d++) {
+			int nx = x + flowOffsetX[d], ny = y + flowOffsetY[d];
+			if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+			float drop = (h - image[ny * width + nx].x) * ((d & 1) ? 0.70710678f : 1.0f);
+			if (drop > steepest) {
+				steepest = drop;
+				best = d;
+			}
+		}
+		direction[y * width + x] = best;
+	}
+
+	unsigned char countDonors(int x, int y) {
+		unsigned char donors = 0;
+		for (unsigned char d = 0; d < 8; d++) {
+			int nx = x + flowOffsetX[d], ny = y + flowOffsetY[d];
+			if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+			if (direction[ny * width + nx] == ((d + 4) & 7)) donors++;
+		}
+		return donors;
+	}
+
+	// Upstream area of a cell whose donors are all finished
+	float sum(int i) {
+		int x = i % width, y = i / width;
+		float total = 1.0f;
+		for (unsigned char d = 0; d < 8; d++) {
+			int nx = x + flowOffsetX[d], ny = y + flowOffsetY[d];
+			if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+			int n = ny * width + nx;
+			if (direction[n] == ((d + 4) & 7)) total += accumulation[n];
+		}
+		return total;
+	}
+
+	void walk(int i) {
+		accumulation[i] = 1.0f;
+		for (int next = downstream(i); next >= 0; next = downstream(next)) {
+			if (pending[next].fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+			accumulation[next] = sum(next);
+		}
+	}
+
+public:
+	std::vector<unsigned char> direction;	// index into flowOffsetX/Y, or FLOW_NONE
+	std::vector<float> accumulation;		// upstream area in cells, including the cell itself
+
+	FlowRouting(int _width, int _height) : pending(_width * _height) {
+		width = _width;
+		height = _height;
+		direction.resize(width * height);
+		accumulation.resize(width * height);
+	}
+
+	void route(const std::vector<vec4>& image) {
+		auto start = std::chrono::high_resolution_clock::now();
+		auto lap = [&start]() {
+			auto now = std::chrono::high_resolution_clock::now();
+			double ms = std::chrono::duration<double, std::milli>(now - start).count();
+			start = now;
+			return ms;
+		};
+
+		parallelFor(0, height, [&](int y) {
+			for (int x = 0; x < width; x++) findDirection(image, x, y);
+		});
+		flowStats.directionMs = lap();
+
+		parallelFor(0, height, [&](int y) {
+			for (int x = 0; x < width; x++) pending[y * width + x].store(countDonors(x, y), std::memory_order_relaxed);
+		});
+		flowStats.dependencyMs = lap();
+
+		// Sources are found from the directions, pending counts reach zero during the walks as well
+		parallelFor(0, height, [&](int y) {
+			for (int x = 0; x < width; x++) {
+				if (countDonors(x, y) == 0) walk(y * width + x);
+			}
+		});
+		flowStats.accumulationMs = lap();
+
+		float maxAccumulation = 0.0f;
+		for (float a : accumulation) maxAccumulation = max(maxAccumulation, a);
+		flowStats.maxAccumulation = maxAccumulation;
+	}
+};
@@ -0,0 +1,82 @@
+#pragma once
+#include "framework.h"
+#include "camera.h"
+#include "geometry.h"
+
+// Summary of the last flythrough
+struct FlythroughStats {
+	int frames = 0;
+	double averageMs = 0;
+	double maxMs = 0;
+	double averageTriangles = 0;
+	double averagePrimitives = 0;		// terrain primitives counted by the GPU
+	double averageDrawCalls = 0;
+};
+
+FlythroughStats flythroughStats;
+
+// Fixed camera path for comparing render settings: one orbit around the terrain, one step per frame.
+// The time of a frame is measured from one Render call to the next, so it includes the GUI and the
+// buffer swap. The camera is put back where it was afterwards.
+class Flythrough {
+	const int frames = 360;
+	const vec3 center = vec3(0, 30, 0);
+	const float radius = 60;
+
+	int frame = -1;
+	vec3 savedEye, savedDir;
+	std::chrono::high_resolution_clock::time_point last;
+	std::vector<double> frameMs;
+	long long triangles = 0, primitives = 0, drawCalls = 0;
+
+public:
+	bool active() { return frame >= 0; }
+
+	void start(Camera& camera) {
+		savedEye = camera.getEyePos();
+		savedDir = camera.getEyeDir();
+		frame = 0;
+		frameMs.clear();
+		triangles = primitives = drawCalls = 0;
+	}
+
+	// Before the frame is rendered, records the previous one
+	void update(Camera& camera) {
+		if (!active()) return;
+		auto now = std::chrono::high_resolution_clock::now();
+		if (frame > 0) {
+			frameMs.push_back(std::chrono::duration<double, std::milli>(now - last).count());
+			triangles += geometryStats.triangles;
+			primitives += geometryStats.primitives;
+			drawCalls += geometryStats.drawCalls;
+		}
+		last = now;
+
+		if (frame == frames) {
+			finish(camera);
+			return;
+		}
+		camera.orbit(center, radius, 1.0f, 2.0f * (float)M_PI * frame / frames);
+		frame++;
+	}
+
+	void finish(Camera& camera) {
+		camera.setEyePos(savedEye);
+		camera.setEyeDir(savedDir);
+		frame = -1;
+
+		flythroughStats = FlythroughStats();
+		flythroughStats.frames = (int)frameMs.size();
+		for (double ms : frameMs) {
+			flythroughStats.averageMs += ms;
+			flythroughStats.maxMs = max(flythroughStats.maxMs, ms);
+		}
+		flythroughStats.averageMs /= max(1, flythroughStats.frames);
+		flythroughStats.averageTriangles = (double)triangles / max(1, flythroughStats.frames);
+		flythroughStats.averagePrimitives = (double)primitives / max(1, flythroughStats.frames);
+		flythroughStats.averageDrawCalls = (double)drawCalls / max(1, flythroughStats.frames);
+		printf("flythrough: %d frames, %.2f ms average, %.2f ms max, %.0f triangles, %.0f terrain primitives, %.1f draw calls per frame\n",
+			flythroughStats.frames, flythroughStats.averageMs, flythroughStats.maxMs, flythroughStats.averageTriangles, flythroughStats.averagePrimitives,
+			flythroughStats.averageDrawCalls);
+	}
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include "framework.h"
+
+bool terrainCulling = true;
+
+// Culling of the last frame
+struct CullStats {
+	int visible = 0;			// patches drawn
+	int culled = 0;				// subtrees skipped, each counted once
+	int boxTests = 0;
+	double cullMs = 0;			// quadtree traversal with the box tests, including the LOD selection
+	int benchmarkPatches = 0;	// culling benchmark on heightmap texel sized patches
+	double benchmarkFlatMs = 0;
+	double benchmarkTreeMs = 0;
+};
+
+CullStats cullStats;
+
+enum FrustumTest { FRUSTUM_OUTSIDE, FRUSTUM_INTERSECTS, FRUSTUM_INSIDE };
+const int FRUSTUM_ALL_PLANES = 63;
+
+// View frustum as six world space planes, ax + by + cz + w >= 0 inside, taken from the rows of the
+// clip space conditions -w <= x, y, z <= w of the row vector convention p * V * P (Gribb and Hartmann)
+class Frustum {
+	vec4 planes[6];
+	vec3 absNormals[6];
+
+public:
+	void update(const mat4& V, const mat4& P) {
+		mat4 VP = V * P;
+		vec4 column[4];
+		for (int i = 0; i < 4; i++) column[i] = vec4(VP[0][i], VP[1][i], VP[2][i], VP[3][i]);
+		for (int i = 0; i < 3; i++) {
+			planes[2 * i] = column[3] + column[i];
+			planes[2 * i + 1] = column[3] - column[i];
+		}
+		for (int i = 0; i < 6; i++) {
+			planes[i] = planes[i] / length(vec3(planes[i].x, planes[i].y, planes[i].z));
+			absNormals[i] = vec3(fabsf(planes[i].x), fabsf(planes[i].y), fabsf(planes[i].z));
+		}
+	}
+
+	// Axis aligned box given by its center and half size. Only the planes in planeMask are tested, and
+	// the planes the box is entirely inside of are removed from it, so boxes nested in this one can
+	// skip them. The box is inside the frustum once the mask is empty.
+	FrustumTest test(const vec3& center, const vec3& extent, int& planeMask) {
+		for (int i = 0; i < 6; i++) {
+			if (!(planeMask & (1 << i))) continue;
+			float d = planes[i].x * center.x + planes[i].y * center.y + planes[i].z * center.z + planes[i].w;
+			float r = dot(absNormals[i], extent);
+			if (d < -r) return FRUSTUM_OUTSIDE;
+			if (d >= r) planeMask &= ~(1 << i);
+		}
+		return planeMask == 0 ? FRUSTUM_INSIDE : FRUSTUM_INTERSECTS;
+	}
+};
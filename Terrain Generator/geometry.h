@@ -1,60 +1,212 @@
 #pragma once
 #include "framework.h"
+#include "parallel.h"
+#include "shader.h"
+#include "vertexcache.h"
 
+bool geometrySingleDraw = true;		// false issues one draw per strip, for comparison
+bool geometryParallelFill = true;	// false fills the buffers on the calling thread, for comparison
+bool geometryCacheOrder = true;		// grids draw a triangle list in vertex cache order, false the row strips
+bool geometryCompactVertices = true;	// flat terrain grids store GridVertex instead of VertexData, at build time
+
+// Draw submissions of the current frame and memory of the created grids
+struct GeometryStats {
+	int drawCalls = 0;
+	long long triangles = 0;
+	double drawMs = 0;				// CPU time spent in Draw this frame
+	size_t vertexBytes = 0;
+	size_t indexBytes = 0;
+	size_t stripVertexBytes = 0;	// what the old duplicated strip vertices would take
+	size_t patchVertexBytes = 0;	// tessellation patch grid
+	size_t patchIndexBytes = 0;
+	long long primitives = 0;		// generated by the GPU for the terrain, one frame late
+	long long vertexInvocations = 0;	// vertex shader runs for the terrain, one frame late, 0 if unsupported
+	double fillMs = 0;				// vertex and index generation of the last created grid
+	double uploadMs = 0;			// CPU side of the buffer uploads, the copy may still be in flight
+
+	void newFrame() {
+		drawCalls = 0;
+		triangles = 0;
+		drawMs = 0;
+	}
+};
+
+GeometryStats geometryStats;
 
 class Geometry {
 protected:
-	unsigned int vao, vbo;
-	unsigned int nVtxStrip, nStrips;
+	unsigned int vao, vbo, ibo;
+	unsigned int nIdxStrip, nStrips;		// indices per strip including the restart index
+	unsigned int nIdxList = 0;				// cache ordered triangle list after the strips, 0 without
 
 	struct VertexData {
 		vec3 pos;
 		vec2 tex;
 	};
 
-	virtual VertexData GenVertexData(float u, float v) {
-		VertexData vd;
-		vd.tex = vec2(u, v);
-		eval(u, v, vd.pos);
+	// Vertex of flat grids whose height comes from the terrain texture, 4 bytes instead of 20. The
+	// grid point is stored as 16-bit integers and the shaders divide it by the grid size, the uniform
+	// vertexGrid, which keeps j / N exact for any N, unlike normalized values, so that the edges of
+	// neighbouring grids meet. The position follows from the point, so there is no vtxPos.
+	struct GridVertex {
+		unsigned short x, y;
+	};
 
-		return vd;
+	void setVertexFormat(const VertexData*) {
+		glEnableVertexAttribArray(0); // AttArr 0 = POSITION
+		glEnableVertexAttribArray(1); // AttArr 1 = UV
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)offsetof(VertexData, pos));
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)offsetof(VertexData, tex));
 	}
 
-	virtual void eval(float u, float v, vec3& pos) = 0;
-
-public:
-	Geometry() {
-		glGenVertexArrays(1, &vao);
-		glGenBuffers(1, &vbo);
+	void setVertexFormat(const GridVertex*) {
+		glDisableVertexAttribArray(0);
+		glEnableVertexAttribArray(1); // AttArr 1 = grid point, converted to float
+		glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(GridVertex), (void*)offsetof(GridVertex, x));
 	}
 
-	void create(int N, int M) {
-		nVtxStrip = (M + 1) * 2;
+	// (N + 1) x (M + 1) shared vertices, and one triangle strip per row in the index buffer, separated
+	// by the primitive restart index so the whole grid is a single draw. Both buffers are sized up
+	// front and filled a row at a time, fillRow(i, vertices) writes the M + 1 vertices of row i, which
+	// are VertexData or GridVertex.
+	//
+	// With geometryCacheOrder the vertices are stored in Morton order, so neighbours on the grid are
+	// mostly neighbours in memory and in the terrain texture, and a triangle list of the quads in
+	// Morton order, optimized for the vertex cache, follows the strips in the index buffer.
+	template <typename V = VertexData, typename F>
+	void createGrid(int N, int M, const F& fillRow) {
+		auto start = std::chrono::high_resolution_clock::now();
+		nIdxStrip = (M + 1) * 2 + 1;
 		nStrips = N;
-		std::vector<VertexData> vtxData;
-		for (int i = 0; i < N; i++) {
+		std::vector<V> vtxData((size_t)(N + 1) * (M + 1));
+		std::vector<unsigned int> idxData((size_t)N * nIdxStrip);
+		std::vector<unsigned int> remap;		// row major to stored vertex index
+		if (geometryCacheOrder) {
+			std::vector<std::pair<unsigned int, unsigned int>> codes(vtxData.size());
+			for (int i = 0; i <= N; i++) {
+				for (int j = 0; j <= M; j++) codes[i * (M + 1) + j] = { mortonCode(j, i), i * (M + 1) + j };
+			}
+			std::sort(codes.begin(), codes.end());
+			remap.resize(codes.size());
+			for (size_t k = 0; k < codes.size(); k++) remap[codes[k].second] = (unsigned int)k;
+		}
+		auto vertex = [&](int i, int j) {
+			unsigned int v = i * (M + 1) + j;
+			return remap.empty() ? v : remap[v];
+		};
+
+		auto rows = [](int end, const auto& row) {
+			if (geometryParallelFill) parallelFor(0, end, row);
+			else for (int i = 0; i < end; i++) row(i);
+		};
+		rows(N + 1, [&](int i) { fillRow(i, &vtxData[(size_t)i * (M + 1)]); });
+		rows(N, [&](int i) {
+			unsigned int* idx = &idxData[(size_t)i * nIdxStrip];
 			for (int j = 0; j <= M; j++) {
-				vtxData.push_back(GenVertexData((float)j / M, (float)i / N));
-				vtxData.push_back(GenVertexData((float)j / M, (float)(i + 1) / N));
+				*idx++ = vertex(i, j);
+				*idx++ = vertex(i + 1, j);
+			}
+			*idx = 0xFFFFFFFF;
+		});
+		if (geometryCacheOrder) remapVertices(vtxData, remap);
+		geometryStats.fillMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		nIdxList = 0;
+		if (geometryCacheOrder) {
+			start = std::chrono::high_resolution_clock::now();
+			std::vector<std::pair<unsigned int, unsigned int>> quads((size_t)N * M);
+			for (int i = 0; i < N; i++) {
+				for (int j = 0; j < M; j++) quads[i * M + j] = { mortonCode(j, i), i * M + j };
 			}
+			std::sort(quads.begin(), quads.end());
+			std::vector<unsigned int> list;
+			list.reserve(quads.size() * 6);
+			for (auto& quad : quads) {
+				int i = quad.second / M, j = quad.second % M;
+				// The winding of the strips
+				list.insert(list.end(), { vertex(i, j), vertex(i + 1, j), vertex(i, j + 1), vertex(i, j + 1), vertex(i + 1, j), vertex(i + 1, j + 1) });
+			}
+			vertexCacheStats.gridStripAcmr = vertexCacheAcmr(idxData, (long long)nStrips * (nIdxStrip - 3));
+			vertexCacheStats.gridMortonAcmr = vertexCacheAcmr(list, list.size() / 3);
+			optimizeVertexCache(list, (int)vtxData.size());
+			vertexCacheStats.gridAcmr = vertexCacheAcmr(list, list.size() / 3);
+			nIdxList = (unsigned int)list.size();
+			idxData.insert(idxData.end(), list.begin(), list.end());
+			vertexCacheStats.gridOptimizeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 		}
+
+		start = std::chrono::high_resolution_clock::now();
 		glBindVertexArray(vao);
 		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		glBufferData(GL_ARRAY_BUFFER, vtxData.size() * sizeof(VertexData), &vtxData[0], GL_STATIC_DRAW);
-		glEnableVertexAttribArray(0); // AttArr 0 = POSITION
-		glEnableVertexAttribArray(1); // AttArr 1 = UV
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)offsetof(VertexData, pos));
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)offsetof(VertexData, tex));
+		glBufferData(GL_ARRAY_BUFFER, vtxData.size() * sizeof(V), vtxData.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, idxData.size() * sizeof(unsigned int), idxData.data(), GL_STATIC_DRAW);
+		setVertexFormat(vtxData.data());
+		geometryStats.uploadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		geometryStats.vertexBytes += vtxData.size() * sizeof(V);
+		geometryStats.indexBytes += idxData.size() * sizeof(unsigned int);
+		geometryStats.stripVertexBytes += (size_t)N * (M + 1) * 2 * sizeof(VertexData);
+	}
+
+	// Uniforms of the program bound for this draw, for geometries that feed the vertex shader themselves
+	void setProgramUniform(Shader& shader, const char* name, int i) {
+		int location = shader.uniformLocation(name);
+		if (location >= 0) glUniform1i(location, i);
+	}
+
+	void setProgramUniform(Shader& shader, const char* name, float f) {
+		int location = shader.uniformLocation(name);
+		if (location >= 0) glUniform1f(location, f);
+	}
+
+public:
+	Geometry() {
+		glGenVertexArrays(1, &vao);
+		glGenBuffers(1, &vbo);
+		glGenBuffers(1, &ibo);
 	}
 
-	void Draw() {
+	// The shader is bound already, it is passed for the uniforms of geometries that set their own
+	virtual void Draw(Shader&) {
+		auto start = std::chrono::high_resolution_clock::now();
 		glBindVertexArray(vao);
-		for (int i = 0; i < nStrips; i++)
-			glDrawArrays(GL_TRIANGLE_STRIP, i * nVtxStrip, nVtxStrip);
+		glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+		if (geometryCacheOrder && nIdxList > 0) {
+			glDrawElements(GL_TRIANGLES, nIdxList, GL_UNSIGNED_INT, (void*)((size_t)nStrips * nIdxStrip * sizeof(unsigned int)));
+			geometryStats.drawCalls++;
+		} else if (geometrySingleDraw) {
+			glDrawElements(GL_TRIANGLE_STRIP, nStrips * nIdxStrip, GL_UNSIGNED_INT, nullptr);
+			geometryStats.drawCalls++;
+		} else {
+			for (unsigned int i = 0; i < nStrips; i++)
+				glDrawElements(GL_TRIANGLE_STRIP, nIdxStrip - 1, GL_UNSIGNED_INT, (void*)(i * nIdxStrip * sizeof(unsigned int)));
+			geometryStats.drawCalls += nStrips;
+		}
+		geometryStats.triangles += (long long)nStrips * (nIdxStrip - 3);
+		geometryStats.drawMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 	}
 
 	virtual ~Geometry() {
 		glDeleteBuffers(1, &vbo);
+		glDeleteBuffers(1, &ibo);
 		glDeleteVertexArrays(1, &vao);
 	}
 };
+
+// Grid over the parametric surface Surface::eval(u, v, pos), with u and v in [0, 1]. The surface is
+// resolved at compile time, so the vertex loop calls it directly and the compiler can inline it.
+template <class Surface>
+class SurfaceGeometry : public Geometry {
+protected:
+	void create(int N, int M) {
+		Surface& surface = static_cast<Surface&>(*this);
+		createGrid(N, M, [&](int i, VertexData* vd) {
+			float v = (float)i / N;
+			for (int j = 0; j <= M; j++, vd++) {
+				vd->tex = vec2((float)j / M, v);
+				surface.eval(vd->tex.x, v, vd->pos);
+			}
+		});
+	}
+};
@@ -0,0 +1,79 @@
+#pragma once
+#include "framework.h"
+#include "plane.h"
+#include "sphere.h"
+#include "object.h"
+#include "gputimer.h"
+
+// Builds planes and spheres of growing tessellation, filled serially and in parallel, and prints the
+// fill and upload time of each to the console. The memory counters of the scene are left as they were.
+// The grids are built without the cache ordered list, which would take most of the time.
+void benchmarkGeometry() {
+	GeometryStats saved = geometryStats;
+	bool parallelFill = geometryParallelFill;
+	bool cacheOrder = geometryCacheOrder;
+	geometryCacheOrder = false;
+	const int tesselations[] = { 256, 512, 1024, 2048 };
+
+	printf("%-8s %6s %10s %12s %12s %10s %10s\n", "surface", "tess", "vertices", "serial ms", "parallel ms", "Mvert/s", "upload ms");
+	for (int surface = 0; surface < 2; surface++) {
+		for (int tesselation : tesselations) {
+			double fillMs[2], uploadMs = 0;
+			for (int parallel = 0; parallel < 2; parallel++) {
+				geometryParallelFill = parallel == 1;
+				Geometry* geometry = surface == 0 ? (Geometry*)new Plane(tesselation, 1.0f) : (Geometry*)new Sphere(tesselation, 1.0f);
+				fillMs[parallel] = geometryStats.fillMs;
+				auto start = std::chrono::high_resolution_clock::now();
+				glFinish();		// the grids do not wait for their uploads, the benchmark does
+				uploadMs = geometryStats.uploadMs + std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+				delete geometry;
+			}
+			long long vertices = (long long)(tesselation + 1) * (tesselation + 1);
+			printf("%-8s %6d %10lld %12.2f %12.2f %10.1f %10.2f\n", surface == 0 ? "plane" : "sphere", tesselation, vertices,
+				fillMs[0], fillMs[1], vertices / (fillMs[1] * 1000.0), uploadMs);
+		}
+	}
+
+	geometryParallelFill = parallelFill;
+	geometryCacheOrder = cacheOrder;
+	geometryStats = saved;
+}
+
+
+// Draws planes of high tessellation with VertexData and with GridVertex through the shader and
+// material of the terrain, and prints the vertex buffer size and GPU time per draw of each. The planes
+// are drawn as strips, so only the vertex format differs.
+void benchmarkVertexFormat(Object* terrain, const RenderState& state) {
+	GeometryStats saved = geometryStats;
+	bool compact = geometryCompactVertices, cacheOrder = geometryCacheOrder, pulling = gridVertexPulling;
+	geometryCacheOrder = false;
+	gridVertexPulling = false;
+	const int draws = 10;
+	GpuTimer timer;
+
+	printf("%6s %10s %12s %12s %12s %12s\n", "tess", "vertices", "full MB", "compact MB", "full ms", "compact ms");
+	for (int tesselation : { 512, 1024, 2048 }) {
+		double ms[2], megabytes[2];
+		for (int format = 0; format < 2; format++) {
+			geometryCompactVertices = format == 1;
+			geometryStats.vertexBytes = 0;
+			Plane* plane = new Plane(tesselation, state.terrainScale);
+			megabytes[format] = geometryStats.vertexBytes / (1024.0 * 1024.0);
+			Object object(terrain->shader, terrain->material, plane);
+			object.Draw(state);
+			glFinish();
+			timer.begin();
+			for (int i = 0; i < draws; i++) object.Draw(state);
+			timer.end();
+			ms[format] = timer.elapsedMs() / draws;
+			delete plane;
+		}
+		printf("%6d %10lld %12.2f %12.2f %12.3f %12.3f\n", tesselation, (long long)(tesselation + 1) * (tesselation + 1),
+			megabytes[0], megabytes[1], ms[0], ms[1]);
+	}
+
+	geometryCompactVertices = compact;
+	geometryCacheOrder = cacheOrder;
+	gridVertexPulling = pulling;
+	geometryStats = saved;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include "framework.h"
+
+// Pair of GL_TIMESTAMP queries around a span of GPU commands
+class GpuTimer {
+	unsigned int queries[2];
+
+public:
+	GpuTimer() { glGenQueries(2, queries); }
+
+	void begin() { glQueryCounter(queries[0], GL_TIMESTAMP); }
+
+	void end() { glQueryCounter(queries[1], GL_TIMESTAMP); }
+
+	// Waits for the GPU to reach end()
+	double elapsedMs() {
+		GLuint64 start = 0, stop = 0;
+		glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &stop);
+		return (stop - start) / 1.0e6;
+	}
+
+	~GpuTimer() { glDeleteQueries(2, queries); }
+};
+
+// GL_PRIMITIVES_GENERATED query around a span of draws, which also counts what the tessellation
+// stages generate, and where ARB_pipeline_statistics_query is there, a GL_VERTEX_SHADER_INVOCATIONS
+// query, which shows how well the post-transform cache does. Two pairs of queries take turns, and
+// each result is read a frame later, when the GPU has usually finished it.
+class PrimitiveCounter {
+	unsigned int queries[2], vertexQueries[2];
+	bool pending[2] = { false, false };
+	bool vertexStatistics;
+	int current = 0;
+
+public:
+	long long primitives = 0;		// of the previous frame
+	long long vertexInvocations = 0;
+
+	PrimitiveCounter() {
+		glGenQueries(2, queries);
+		glGenQueries(2, vertexQueries);
+		vertexStatistics = GLEW_ARB_pipeline_statistics_query != 0;
+	}
+
+	void begin() {
+		glBeginQuery(GL_PRIMITIVES_GENERATED, queries[current]);
+		if (vertexStatistics) glBeginQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB, vertexQueries[current]);
+	}
+
+	void end() {
+		glEndQuery(GL_PRIMITIVES_GENERATED);
+		if (vertexStatistics) glEndQuery(GL_VERTEX_SHADER_INVOCATIONS_ARB);
+		pending[current] = true;
+		current = 1 - current;
+		if (pending[current]) {
+			GLuint64 count = 0;
+			glGetQueryObjectui64v(queries[current], GL_QUERY_RESULT, &count);
+			primitives = (long long)count;
+			if (vertexStatistics) {
+				glGetQueryObjectui64v(vertexQueries[current], GL_QUERY_RESULT, &count);
+				vertexInvocations = (long long)count;
+			}
+			pending[current] = false;
+		}
+	}
+
+	~PrimitiveCounter() {
+		glDeleteQueries(2, queries);
+		glDeleteQueries(2, vertexQueries);
+	}
+};
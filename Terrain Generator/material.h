@@ -1,9 +1,11 @@
 #pragma once
 #include "framework.h"
+#include "uniformblocks.h"
 
 struct Material {
 	vec3 kd, ks, ka;
 	float shininess;
+	UniformBuffer<MaterialUniforms> buffer;
 
 public:
 	Material(vec3 _kd, vec3 _ks, vec3 _ka, float _shininess) {
@@ -11,5 +13,18 @@ public:
 		ks = _ks;
 		ka = _ka;
 		shininess = _shininess;
+		update();
 	}
+
+	// Uploads the block, after the parameters changed
+	void update() {
+		MaterialUniforms uniforms;
+		uniforms.kd = kd;
+		uniforms.ks = ks;
+		uniforms.ka = ka;
+		uniforms.shininess = shininess;
+		buffer.update(uniforms);
+	}
+
+	void bind() { buffer.bind(MATERIAL_BLOCK); }
 };
\ No newline at end of file
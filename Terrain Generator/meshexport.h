@@ -0,0 +1,75 @@
+#pragma once
+#include "framework.h"
+#include <string>
+
+// Writers for an indexed triangle mesh with positions and texture coordinates. Triangles are counter
+// clockwise seen from their front side, as both formats expect.
+
+bool exportObj(const char* path, const std::vector<vec3>& positions, const std::vector<vec2>& uvs, const std::vector<unsigned int>& indices) {
+	FILE* file = fopen(path, "w");
+	if (file == nullptr) {
+		printf("cannot write %s\n", path);
+		return false;
+	}
+	fprintf(file, "# %d vertices, %d triangles\n", (int)positions.size(), (int)indices.size() / 3);
+	for (const vec3& p : positions) fprintf(file, "v %.6f %.6f %.6f\n", p.x, p.y, p.z);
+	for (const vec2& t : uvs) fprintf(file, "vt %.6f %.6f\n", t.x, 1.0f - t.y);
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		unsigned int a = indices[i] + 1, b = indices[i + 1] + 1, c = indices[i + 2] + 1;
+		fprintf(file, "f %u/%u %u/%u %u/%u\n", a, a, b, b, c, c);
+	}
+	fclose(file);
+	return true;
+}
+
+std::string base64(const std::vector<unsigned char>& data) {
+	const char* digits = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string out;
+	out.reserve((data.size() + 2) / 3 * 4);
+	for (size_t i = 0; i < data.size(); i += 3) {
+		unsigned int n = data[i] << 16;
+		if (i + 1 < data.size()) n |= data[i + 1] << 8;
+		if (i + 2 < data.size()) n |= data[i + 2];
+		out += digits[(n >> 18) & 63];
+		out += digits[(n >> 12) & 63];
+		out += i + 1 < data.size() ? digits[(n >> 6) & 63] : '=';
+		out += i + 2 < data.size() ? digits[n & 63] : '=';
+	}
+	return out;
+}
+
+// glTF 2.0 with the buffer embedded as a data URI, so the mesh is a single file
+bool exportGltf(const char* path, const std::vector<vec3>& positions, const std::vector<vec2>& uvs, const std::vector<unsigned int>& indices) {
+	FILE* file = fopen(path, "w");
+	if (file == nullptr) {
+		printf("cannot write %s\n", path);
+		return false;
+	}
+	vec3 lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (const vec3& p : positions) {
+		lo = vec3(min(lo.x, p.x), min(lo.y, p.y), min(lo.z, p.z));
+		hi = vec3(max(hi.x, p.x), max(hi.y, p.y), max(hi.z, p.z));
+	}
+
+	size_t positionBytes = positions.size() * sizeof(vec3), uvBytes = uvs.size() * sizeof(vec2), indexBytes = indices.size() * sizeof(unsigned int);
+	std::vector<unsigned char> buffer(positionBytes + uvBytes + indexBytes);
+	memcpy(buffer.data(), positions.data(), positionBytes);
+	memcpy(buffer.data() + positionBytes, uvs.data(), uvBytes);
+	memcpy(buffer.data() + positionBytes + uvBytes, indices.data(), indexBytes);
+
+	fprintf(file, "{\n\"asset\": {\"version\": \"2.0\", \"generator\": \"Terrain Generator\"},\n");
+	fprintf(file, "\"scene\": 0, \"scenes\": [{\"nodes\": [0]}], \"nodes\": [{\"mesh\": 0, \"name\": \"terrain\"}],\n");
+	fprintf(file, "\"meshes\": [{\"primitives\": [{\"attributes\": {\"POSITION\": 0, \"TEXCOORD_0\": 1}, \"indices\": 2, \"mode\": 4}]}],\n");
+	fprintf(file, "\"accessors\": [\n");
+	fprintf(file, "{\"bufferView\": 0, \"componentType\": 5126, \"count\": %d, \"type\": \"VEC3\", \"min\": [%f, %f, %f], \"max\": [%f, %f, %f]},\n",
+		(int)positions.size(), lo.x, lo.y, lo.z, hi.x, hi.y, hi.z);
+	fprintf(file, "{\"bufferView\": 1, \"componentType\": 5126, \"count\": %d, \"type\": \"VEC2\"},\n", (int)uvs.size());
+	fprintf(file, "{\"bufferView\": 2, \"componentType\": 5125, \"count\": %d, \"type\": \"SCALAR\"}],\n", (int)indices.size());
+	fprintf(file, "\"bufferViews\": [\n");
+	fprintf(file, "{\"buffer\": 0, \"byteOffset\": 0, \"byteLength\": %zu, \"target\": 34962},\n", positionBytes);
+	fprintf(file, "{\"buffer\": 0, \"byteOffset\": %zu, \"byteLength\": %zu, \"target\": 34962},\n", positionBytes, uvBytes);
+	fprintf(file, "{\"buffer\": 0, \"byteOffset\": %zu, \"byteLength\": %zu, \"target\": 34963}],\n", positionBytes + uvBytes, indexBytes);
+	fprintf(file, "\"buffers\": [{\"byteLength\": %zu, \"uri\": \"data:application/octet-stream;base64,%s\"}]\n}\n", buffer.size(), base64(buffer).c_str());
+	fclose(file);
+	return true;
+}
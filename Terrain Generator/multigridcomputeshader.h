@@ -0,0 +1,76 @@
+#pragma once
+#include "framework.h"
+#include "computeshader.h"
+
+int erosionLevels = 1;						// 1 = erode the full resolution map only
+float erosionLevelDropletScale = 0.5;		// droplets of a level relative to the next coarser one
+
+// Moves heightmaps between the levels of the multi-resolution erosion schedule
+class MultigridComputeShader : ComputeShader {
+	const char* computeShaderSource = R"(
+		#version 450 core
+
+		layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+		layout(rgba32f, binding = 1) uniform readonly image2D coarseEroded;		// propagate only
+		layout(rgba32f, binding = 2) uniform image2D coarse;
+		layout(rgba32f, binding = 3) uniform image2D fine;
+
+		uniform int pass;
+
+		float coarseChange(ivec2 p) {
+			p = clamp(p, ivec2(0), imageSize(coarse) - 1);
+			return imageLoad(coarseEroded, p).r - imageLoad(coarse, p).r;
+		}
+
+		void main() {
+			if (pass == 0) {
+				// Downsample: 2x2 box filter of the fine level
+				ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+				if (any(greaterThanEqual(p, imageSize(coarse)))) return;
+				ivec2 last = imageSize(fine) - 1;
+				float h = imageLoad(fine, min(2 * p, last)).r + imageLoad(fine, min(2 * p + ivec2(1, 0), last)).r
+						+ imageLoad(fine, min(2 * p + ivec2(0, 1), last)).r + imageLoad(fine, min(2 * p + ivec2(1, 1), last)).r;
+				imageStore(coarse, p, vec4(vec3(0.25 * h), 1.0));
+			}
+			else if (pass == 1) {
+				// Propagate: add the bilinearly upsampled change of the coarse level to the fine level
+				ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+				if (any(greaterThanEqual(p, imageSize(fine)))) return;
+				vec2 c = (vec2(p) + 0.5) * 0.5 - 0.5;
+				ivec2 c0 = ivec2(floor(c));
+				vec2 t = c - vec2(c0);
+				float change = mix(mix(coarseChange(c0), coarseChange(c0 + ivec2(1, 0)), t.x),
+								   mix(coarseChange(c0 + ivec2(0, 1)), coarseChange(c0 + ivec2(1, 1)), t.x), t.y);
+				float h = imageLoad(fine, p).r + change;
+				imageStore(fine, p, vec4(h, h, h, 1.0));
+			}
+		}
+		)";
+
+	void dispatch(int pass, int width, int height) {
+		setUniform("pass", pass);
+		glDispatchCompute((width + 15) / 16, (height + 15) / 16, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+
+public:
+	MultigridComputeShader() { create(computeShaderSource); }
+
+	void Bind() { glUseProgram(getId()); }
+
+	void downsample(unsigned int fineTexture, unsigned int coarseTexture, int coarseWidth, int coarseHeight) {
+		Bind();
+		glBindImageTexture(2, coarseTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glBindImageTexture(3, fineTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+		dispatch(0, coarseWidth, coarseHeight);
+	}
+
+	// coarseTexture holds the downsampled state before the coarse level was eroded
+	void propagate(unsigned int coarseErodedTexture, unsigned int coarseTexture, unsigned int fineTexture, int fineWidth, int fineHeight) {
+		Bind();
+		glBindImageTexture(1, coarseErodedTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+		glBindImageTexture(2, coarseTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+		glBindImageTexture(3, fineTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+		dispatch(1, fineWidth, fineHeight);
+	}
+};
@@ -0,0 +1,46 @@
+#pragma once
+#include "framework.h"
+#include "parallel.h"
+
+// Timings of the last normal map
+struct NormalStats {
+	double sobelMs = 0;
+	double uploadMs = 0;
+};
+
+NormalStats normalStats;
+
+// Height gradient of the terrain map per texel, from a 3x3 Sobel kernel with the edges clamped. The
+// gradient is in normalized height per unit of texture coordinate, so the shaders turn it into a normal
+// with the current amplitude and size of the terrain and one normalize, and the map stays valid while
+// the amplitude slider moves. Rows are computed in parallel.
+class NormalMap {
+	int width, height;
+
+	float h(const std::vector<vec4>& image, int x, int y) {
+		return image[max(0, min(y, height - 1)) * width + max(0, min(x, width - 1))].x;
+	}
+
+public:
+	std::vector<vec2> gradients;
+
+	NormalMap(int _width, int _height) {
+		width = _width;
+		height = _height;
+		gradients.resize(width * height);
+	}
+
+	void compute(const std::vector<vec4>& image) {
+		auto start = std::chrono::high_resolution_clock::now();
+		parallelFor(0, height, [&](int y) {
+			for (int x = 0; x < width; x++) {
+				float gx = h(image, x + 1, y - 1) + 2 * h(image, x + 1, y) + h(image, x + 1, y + 1)
+					- h(image, x - 1, y - 1) - 2 * h(image, x - 1, y) - h(image, x - 1, y + 1);
+				float gy = h(image, x - 1, y + 1) + 2 * h(image, x, y + 1) + h(image, x + 1, y + 1)
+					- h(image, x - 1, y - 1) - 2 * h(image, x, y - 1) - h(image, x + 1, y - 1);
+				gradients[y * width + x] = vec2(gx * width / 8.0f, gy * height / 8.0f);
+			}
+		});
+		normalStats.sobelMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+};
@@ -14,6 +14,7 @@ struct Object {
 	Shader* shader;
 	Material* material;
 	Geometry* geometry;
+	UniformBuffer<ObjectUniforms> objectBuffer;
 
 public:
 	Object(Shader* _shader, Material* _material, Geometry* _geometry) {
@@ -26,12 +27,22 @@ public:
 		geometry = _geometry;
 	}
 
+	// The frame and light blocks are bound by the scene, the object and material blocks here
 	void Draw(RenderState state) {
+		auto start = std::chrono::high_resolution_clock::now();
 		mat4 M = ScaleMatrix(scale) * RotationMatrix(rotAngle, rotAxis) * TranslateMatrix(pos);
 		state.M = M;
 		state.MVP = state.M * state.V * state.P;
 		state.material = material;
+		ObjectUniforms uniforms;
+		uniforms.MVP = state.MVP;
+		uniforms.M = state.M;
+		objectBuffer.update(uniforms);
+		objectBuffer.bind(OBJECT_BLOCK);
+		material->bind();
 		shader->Bind(state);
-		geometry->Draw();
+		uniformStats.binds++;
+		geometry->Draw(*shader);
+		uniformStats.drawMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 	}
 };
@@ -0,0 +1,104 @@
+#pragma once
+#include "framework.h"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+// Worker threads started on the first parallelFor and kept for the rest of the run. One loop runs on them
+// at a time; a loop started while another one is running, from a background thread or from inside a loop
+// body, runs on its own thread instead of waiting for the workers.
+class ThreadPool {
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake, finished;
+	std::atomic<bool> busy{ false };
+	const std::function<void(int)>* job = nullptr;
+	int chunks = 0, nextChunk = 0, running = 0;
+	unsigned long long generation = 0;
+	bool stopping = false;
+
+	// Takes chunks of the current job until none is left, the lock is held on entry and on return
+	void drain(std::unique_lock<std::mutex>& lock) {
+		while (nextChunk < chunks) {
+			int c = nextChunk++;
+			running++;
+			lock.unlock();
+			(*job)(c);
+			lock.lock();
+			running--;
+		}
+		if (running == 0) finished.notify_all();
+	}
+
+	void work() {
+		unsigned long long seen = 0;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			wake.wait(lock, [&]() { return stopping || generation != seen; });
+			if (stopping) return;
+			seen = generation;
+			drain(lock);
+		}
+	}
+
+public:
+	ThreadPool() {
+		int nThreads = max(1, (int)std::thread::hardware_concurrency());
+		for (int t = 1; t < nThreads; t++) workers.emplace_back([this]() { work(); });
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers) worker.join();
+	}
+
+	// Threads a loop is split over, the calling one included
+	int size() { return (int)workers.size() + 1; }
+
+	// Runs chunk(c) for every c in [0, nChunks) on the workers and the calling thread. Returns false without
+	// running anything if the pool is taken.
+	bool run(int nChunks, const std::function<void(int)>& chunk) {
+		bool expected = false;
+		if (!busy.compare_exchange_strong(expected, true)) return false;
+		std::unique_lock<std::mutex> lock(mutex);
+		job = &chunk;
+		chunks = nChunks;
+		nextChunk = 0;
+		generation++;
+		wake.notify_all();
+		drain(lock);
+		finished.wait(lock, [&]() { return running == 0; });
+		job = nullptr;
+		lock.unlock();
+		busy = false;
+		return true;
+	}
+};
+
+inline ThreadPool& threadPool() {
+	static ThreadPool pool;
+	return pool;
+}
+
+// Runs body(i) for every i in [begin, end), split into one contiguous chunk per pool thread.
+// Every index is visited exactly once, so kernels that only write their own index stay deterministic.
+template <typename F>
+void parallelFor(int begin, int end, const F& body) {
+	int count = end - begin;
+	if (count <= 0) return;
+
+	ThreadPool& pool = threadPool();
+	int nChunks = min(pool.size(), count);
+	int chunk = (count + nChunks - 1) / nChunks;
+	auto runChunk = [&](int c) {
+		for (int i = begin + c * chunk; i < min(end, begin + (c + 1) * chunk); i++) body(i);
+	};
+	if (nChunks > 1 && pool.run(nChunks, runChunk)) return;
+	for (int i = begin; i < end; i++) body(i);
+}
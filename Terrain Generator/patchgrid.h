@@ -0,0 +1,61 @@
+#pragma once
+#include "geometry.h"
+
+const int TESS_PATCH_GRID = 32;		// patches per side
+
+// Coarse grid of quad patches over the plane for the tessellation stages, the vertex data is only the
+// (N + 1)^2 patch corners
+class PatchGrid : public Geometry {
+	float scale;
+	int nPatches;
+
+public:
+	PatchGrid(int N, float _scale) {
+		scale = _scale;
+		nPatches = N * N;
+
+		std::vector<VertexData> vtxData((N + 1) * (N + 1));
+		for (int i = 0; i <= N; i++) {
+			for (int j = 0; j <= N; j++) {
+				VertexData& vd = vtxData[i * (N + 1) + j];
+				vd.tex = vec2((float)j / N, (float)i / N);
+				vd.pos = vec3((vd.tex.x - 0.5f) * scale, 0, (vd.tex.y - 0.5f) * scale);
+			}
+		}
+
+		// Corners in the order of the gl_TessCoord of the evaluation stage: 00, 10, 11, 01
+		std::vector<unsigned int> idxData;
+		idxData.reserve(4 * nPatches);
+		for (int i = 0; i < N; i++) {
+			for (int j = 0; j < N; j++) {
+				idxData.push_back(i * (N + 1) + j);
+				idxData.push_back(i * (N + 1) + j + 1);
+				idxData.push_back((i + 1) * (N + 1) + j + 1);
+				idxData.push_back((i + 1) * (N + 1) + j);
+			}
+		}
+
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, vtxData.size() * sizeof(VertexData), vtxData.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, idxData.size() * sizeof(unsigned int), idxData.data(), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0); // AttArr 0 = POSITION
+		glEnableVertexAttribArray(1); // AttArr 1 = UV
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)offsetof(VertexData, pos));
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)offsetof(VertexData, tex));
+
+		geometryStats.patchVertexBytes = vtxData.size() * sizeof(VertexData);
+		geometryStats.patchIndexBytes = idxData.size() * sizeof(unsigned int);
+	}
+
+	void Draw(Shader& shader) {
+		auto start = std::chrono::high_resolution_clock::now();
+		setProgramUniform(shader, "gridScale", scale);
+		glBindVertexArray(vao);
+		glPatchParameteri(GL_PATCH_VERTICES, 4);
+		glDrawElements(GL_PATCHES, 4 * nPatches, GL_UNSIGNED_INT, nullptr);
+		geometryStats.drawCalls++;
+		geometryStats.drawMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+};
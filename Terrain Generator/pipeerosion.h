@@ -0,0 +1,141 @@
+#pragma once
+#include "framework.h"
+#include "parallel.h"
+#include "pipeerosioncomputeshader.h"
+
+// CPU version of PipeErosionComputeShader. The passes mirror the compute shader line by line, run
+// row-parallel over flat arrays, and only ever write the current cell, so the result matches the GPU.
+class PipeErosion {
+	int width, height;
+	std::vector<float> terrain[2], sediment[2], water;
+	std::vector<vec4> flux;			// outflow towards -x, +x, -y, +y
+	std::vector<vec2> velocity;
+
+	int cell(int x, int y) {
+		return max(0, min(y, height - 1)) * width + max(0, min(x, width - 1));
+	}
+
+	void fluxPass(int y) {
+		const float* b = terrain[0].data();
+		const float* d = water.data();
+		for (int x = 0; x < width; x++) {
+			int i = cell(x, y);
+			int iL = cell(x - 1, y), iR = cell(x + 1, y), iB = cell(x, y - 1), iT = cell(x, y + 1);
+
+			float h = b[i] + d[i];
+			vec4 f = flux[i];
+			f.x = x > 0 ? max(0.0f, f.x + pipeTimeStep * pipeGravity * (h - b[iL] - d[iL])) : 0.0f;
+			f.y = x < width - 1 ? max(0.0f, f.y + pipeTimeStep * pipeGravity * (h - b[iR] - d[iR])) : 0.0f;
+			f.z = y > 0 ? max(0.0f, f.z + pipeTimeStep * pipeGravity * (h - b[iB] - d[iB])) : 0.0f;
+			f.w = y < height - 1 ? max(0.0f, f.w + pipeTimeStep * pipeGravity * (h - b[iT] - d[iT])) : 0.0f;
+
+			// A cell cannot drain more water than it holds
+			float outflow = (f.x + f.y + f.z + f.w) * pipeTimeStep;
+			if (outflow > d[i]) f = f * (d[i] / outflow);
+			flux[i] = f;
+		}
+	}
+
+	void waterPass(int y) {
+		for (int x = 0; x < width; x++) {
+			int i = cell(x, y);
+			vec4 f = flux[i];
+			float inL = x > 0 ? flux[cell(x - 1, y)].y : 0.0f;
+			float inR = x < width - 1 ? flux[cell(x + 1, y)].x : 0.0f;
+			float inB = y > 0 ? flux[cell(x, y - 1)].w : 0.0f;
+			float inT = y < height - 1 ? flux[cell(x, y + 1)].z : 0.0f;
+
+			float depth = water[i];
+			float newDepth = max(0.0f, depth + pipeTimeStep * ((inL + inR + inB + inT) - (f.x + f.y + f.z + f.w)));
+			float meanDepth = 0.5f * (depth + newDepth);
+			vec2 flow = 0.5f * vec2(inL - f.x + f.y - inR, inB - f.z + f.w - inT);
+
+			velocity[i] = meanDepth > 1e-4f ? flow / meanDepth : vec2(0, 0);
+			water[i] = newDepth;
+		}
+	}
+
+	void erosionPass(int y) {
+		const float* bIn = terrain[0].data();
+		for (int x = 0; x < width; x++) {
+			int i = cell(x, y);
+			float b = bIn[i];
+			float s = sediment[0][i];
+			float dx = 0.5f * (fabsf(bIn[cell(x + 1, y)] - b) + fabsf(b - bIn[cell(x - 1, y)]));
+			float dy = 0.5f * (fabsf(bIn[cell(x, y + 1)] - b) + fabsf(b - bIn[cell(x, y - 1)]));
+			float slope = dx * dx + dy * dy;
+			float sinTilt = sqrtf(slope / (1.0f + slope));
+
+			float capacity = pipeSedimentCapacity * max(sinTilt, 0.05f) * length(velocity[i]) * min(water[i], 1.0f);
+			if (capacity > s) {
+				float amount = pipeTimeStep * pipeDissolveRate * (capacity - s);
+				b -= amount;
+				s += amount;
+			} else {
+				float amount = pipeTimeStep * pipeDepositionRate * (s - capacity);
+				b += amount;
+				s -= amount;
+			}
+			terrain[1][i] = b;
+			sediment[1][i] = s;
+		}
+	}
+
+	void transportPass(int y) {
+		const float* sIn = sediment[0].data();
+		for (int x = 0; x < width; x++) {
+			int i = cell(x, y);
+
+			// Semi-Lagrangian step: fetch the sediment from where the water came from
+			vec2 from = vec2((float)x, (float)y) - velocity[i] * pipeTimeStep;
+			from.x = max(0.0f, min(from.x, (float)(width - 1)));
+			from.y = max(0.0f, min(from.y, (float)(height - 1)));
+			int x0 = (int)floorf(from.x), y0 = (int)floorf(from.y);
+			float tx = from.x - x0, ty = from.y - y0;
+			float s0 = lerp(sIn[cell(x0, y0)], sIn[cell(x0 + 1, y0)], tx);
+			float s1 = lerp(sIn[cell(x0, y0 + 1)], sIn[cell(x0 + 1, y0 + 1)], tx);
+			sediment[1][i] = lerp(s0, s1, ty);
+
+			water[i] = water[i] * (1.0f - pipeEvaporationRate * pipeTimeStep) + pipeRainRate * pipeTimeStep;
+		}
+	}
+
+public:
+	PipeErosion(int _width, int _height) {
+		width = _width;
+		height = _height;
+		for (int k = 0; k < 2; k++) {
+			terrain[k].resize(width * height);
+			sediment[k].resize(width * height);
+		}
+		water.resize(width * height);
+		flux.resize(width * height);
+		velocity.resize(width * height);
+	}
+
+	void erode(std::vector<vec4>& image) {
+		for (int i = 0; i < width * height; i++) {
+			terrain[0][i] = image[i].x * terrainAmplitude;
+			sediment[0][i] = 0.0f;
+			water[i] = 0.0f;
+			flux[i] = vec4(0, 0, 0, 0);
+			velocity[i] = vec2(0, 0);
+		}
+
+		for (int step = 0; step < pipeErosionSteps; step++) {
+			parallelFor(0, height, [this](int y) { fluxPass(y); });
+			parallelFor(0, height, [this](int y) { waterPass(y); });
+			parallelFor(0, height, [this](int y) { erosionPass(y); });
+			std::swap(terrain[0], terrain[1]);
+			std::swap(sediment[0], sediment[1]);
+			parallelFor(0, height, [this](int y) { transportPass(y); });
+			std::swap(sediment[0], sediment[1]);
+		}
+
+		// Suspended sediment settles where it is
+		for (int i = 0; i < width * height; i++) {
+			float h = (terrain[0][i] + sediment[0][i]) / terrainAmplitude;
+			image[i] = vec4(h, h, h, 1);
+		}
+	}
+};
@@ -0,0 +1,222 @@
+#pragma once
+#include "framework.h"
+#include "computeshader.h"
+#include "erosioncomputeshader.h"
+
+int pipeErosionSteps = 400;
+float pipeTimeStep = 0.05;
+float pipeGravity = 9.81;
+float pipeRainRate = 0.2;
+float pipeEvaporationRate = 0.1;
+float pipeSedimentCapacity = 0.2;
+float pipeDissolveRate = 0.3;
+float pipeDepositionRate = 0.3;
+
+// Passes of the virtual pipe model, shared by the CPU and GPU implementations
+enum PipeErosionPass {
+	PIPE_PASS_INIT,			// heightmap -> terrain buffer
+	PIPE_PASS_FLUX,			// outflow through the four pipes of every cell
+	PIPE_PASS_WATER,		// water height and velocity from the net flux
+	PIPE_PASS_EROSION,		// dissolve or deposit sediment against the transport capacity
+	PIPE_PASS_TRANSPORT,	// advect sediment along the velocity field, rain and evaporation
+	PIPE_PASS_WRITEBACK		// terrain buffer (+ suspended sediment) -> heightmap
+};
+
+class PipeErosionComputeShader : ComputeShader {
+	const char* computeShaderSource = R"(
+		#version 450 core
+
+		layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+		layout(rgba32f, binding = 0) uniform image2D heightMap;
+
+		// Every pass writes only its own cell, neighbours are read from buffers the pass does not write
+		layout(std430, binding = 0) buffer TerrainIn { float terrainIn[]; };
+		layout(std430, binding = 1) buffer TerrainOut { float terrainOut[]; };
+		layout(std430, binding = 2) buffer Water { float water[]; };
+		layout(std430, binding = 3) buffer SedimentIn { float sedimentIn[]; };
+		layout(std430, binding = 4) buffer SedimentOut { float sedimentOut[]; };
+		layout(std430, binding = 5) buffer Flux { vec4 flux[]; };			// outflow towards -x, +x, -y, +y
+		layout(std430, binding = 6) buffer Velocity { vec2 velocity[]; };
+
+		// Parameters
+		uniform int pass;
+		uniform float terrainAmplitude;
+		uniform float timeStep;
+		uniform float gravity;
+		uniform float rainRate;
+		uniform float evaporationRate;
+		uniform float sedimentCapacity;
+		uniform float dissolveRate;
+		uniform float depositionRate;
+
+		int cell(int x, int y) {
+			ivec2 dimensions = imageSize(heightMap);
+			return clamp(y, 0, dimensions.y - 1) * dimensions.x + clamp(x, 0, dimensions.x - 1);
+		}
+
+		void main() {
+			ivec2 dimensions = imageSize(heightMap);
+			ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+			if (p.x >= dimensions.x || p.y >= dimensions.y) return;
+
+			int i = cell(p.x, p.y);
+			int iL = cell(p.x - 1, p.y);
+			int iR = cell(p.x + 1, p.y);
+			int iB = cell(p.x, p.y - 1);
+			int iT = cell(p.x, p.y + 1);
+			bool hasL = p.x > 0, hasR = p.x < dimensions.x - 1;
+			bool hasB = p.y > 0, hasT = p.y < dimensions.y - 1;
+
+			if (pass == 0) {
+				terrainIn[i] = imageLoad(heightMap, p).r * terrainAmplitude;
+			}
+			else if (pass == 1) {
+				float h = terrainIn[i] + water[i];
+				vec4 f = flux[i];
+				f.x = hasL ? max(0.0, f.x + timeStep * gravity * (h - terrainIn[iL] - water[iL])) : 0.0;
+				f.y = hasR ? max(0.0, f.y + timeStep * gravity * (h - terrainIn[iR] - water[iR])) : 0.0;
+				f.z = hasB ? max(0.0, f.z + timeStep * gravity * (h - terrainIn[iB] - water[iB])) : 0.0;
+				f.w = hasT ? max(0.0, f.w + timeStep * gravity * (h - terrainIn[iT] - water[iT])) : 0.0;
+
+				// A cell cannot drain more water than it holds
+				float outflow = (f.x + f.y + f.z + f.w) * timeStep;
+				if (outflow > water[i]) f *= water[i] / outflow;
+				flux[i] = f;
+			}
+			else if (pass == 2) {
+				vec4 f = flux[i];
+				float inL = hasL ? flux[iL].y : 0.0;
+				float inR = hasR ? flux[iR].x : 0.0;
+				float inB = hasB ? flux[iB].w : 0.0;
+				float inT = hasT ? flux[iT].z : 0.0;
+
+				float depth = water[i];
+				float newDepth = max(0.0, depth + timeStep * ((inL + inR + inB + inT) - (f.x + f.y + f.z + f.w)));
+				float meanDepth = 0.5 * (depth + newDepth);
+				vec2 flow = 0.5 * vec2(inL - f.x + f.y - inR, inB - f.z + f.w - inT);
+
+				velocity[i] = meanDepth > 1e-4 ? flow / meanDepth : vec2(0.0);
+				water[i] = newDepth;
+			}
+			else if (pass == 3) {
+				float b = terrainIn[i];
+				float s = sedimentIn[i];
+				float dx = 0.5 * (abs(terrainIn[iR] - b) + abs(b - terrainIn[iL]));		// mean of both side steps, unlike a central difference it does not cancel in pits
+				float dy = 0.5 * (abs(terrainIn[iT] - b) + abs(b - terrainIn[iB]));
+				float slope = dx * dx + dy * dy;
+				float sinTilt = sqrt(slope / (1.0 + slope));
+
+				float capacity = sedimentCapacity * max(sinTilt, 0.05) * length(velocity[i]) * min(water[i], 1.0);
+				if (capacity > s) {
+					float amount = timeStep * dissolveRate * (capacity - s);
+					b -= amount;
+					s += amount;
+				} else {
+					float amount = timeStep * depositionRate * (s - capacity);
+					b += amount;
+					s -= amount;
+				}
+				terrainOut[i] = b;
+				sedimentOut[i] = s;
+			}
+			else if (pass == 4) {
+				// Semi-Lagrangian step: fetch the sediment from where the water came from
+				vec2 from = clamp(vec2(p) - velocity[i] * timeStep, vec2(0.0), vec2(dimensions - 1));
+				ivec2 p0 = ivec2(floor(from));
+				vec2 t = from - vec2(p0);
+				float s0 = mix(sedimentIn[cell(p0.x, p0.y)], sedimentIn[cell(p0.x + 1, p0.y)], t.x);
+				float s1 = mix(sedimentIn[cell(p0.x, p0.y + 1)], sedimentIn[cell(p0.x + 1, p0.y + 1)], t.x);
+				sedimentOut[i] = mix(s0, s1, t.y);
+
+				water[i] = water[i] * (1.0 - evaporationRate * timeStep) + rainRate * timeStep;
+			}
+			else if (pass == 5) {
+				// Suspended sediment settles where it is
+				float h = (terrainIn[i] + sedimentIn[i]) / terrainAmplitude;
+				imageStore(heightMap, p, vec4(h, h, h, 1.0));
+			}
+		}
+		)";
+
+	int width, height;
+	unsigned int terrainBuffers[2], sedimentBuffers[2], waterBuffer, fluxBuffer, velocityBuffer;
+
+	void dispatch(int pass) {
+		setUniform("pass", pass);
+		glDispatchCompute((width + 15) / 16, (height + 15) / 16, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	void bindBuffers(int terrainIn, int sedimentIn) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, terrainBuffers[terrainIn]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, terrainBuffers[1 - terrainIn]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, sedimentBuffers[sedimentIn]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, sedimentBuffers[1 - sedimentIn]);
+	}
+
+public:
+	PipeErosionComputeShader(int _width, int _height) {
+		width = _width;
+		height = _height;
+		create(computeShaderSource);
+
+		unsigned int* scalarBuffers[] = { &terrainBuffers[0], &terrainBuffers[1], &sedimentBuffers[0], &sedimentBuffers[1], &waterBuffer };
+		for (unsigned int* buffer : scalarBuffers) {
+			glCreateBuffers(1, buffer);
+			glNamedBufferStorage(*buffer, width * height * sizeof(float), nullptr, GL_DYNAMIC_STORAGE_BIT);
+		}
+		glCreateBuffers(1, &fluxBuffer);
+		glNamedBufferStorage(fluxBuffer, width * height * sizeof(vec4), nullptr, GL_DYNAMIC_STORAGE_BIT);
+		glCreateBuffers(1, &velocityBuffer);
+		glNamedBufferStorage(velocityBuffer, width * height * sizeof(vec2), nullptr, GL_DYNAMIC_STORAGE_BIT);
+	}
+
+	void Bind() {
+		glUseProgram(getId());	// make this program run
+
+		setUniform("terrainAmplitude", terrainAmplitude);
+		setUniform("timeStep", pipeTimeStep);
+		setUniform("gravity", pipeGravity);
+		setUniform("rainRate", pipeRainRate);
+		setUniform("evaporationRate", pipeEvaporationRate);
+		setUniform("sedimentCapacity", pipeSedimentCapacity);
+		setUniform("dissolveRate", pipeDissolveRate);
+		setUniform("depositionRate", pipeDepositionRate);
+
+		// Water, sediment and flux start out empty
+		float zero = 0.0f;
+		unsigned int clearedBuffers[] = { sedimentBuffers[0], waterBuffer, fluxBuffer, velocityBuffer };
+		for (unsigned int buffer : clearedBuffers) glClearNamedBufferData(buffer, GL_R32F, GL_RED, GL_FLOAT, &zero);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, waterBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, fluxBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, velocityBuffer);
+
+		int terrainIn = 0, sedimentIn = 0;
+		bindBuffers(terrainIn, sedimentIn);
+		dispatch(PIPE_PASS_INIT);
+
+		for (int step = 0; step < pipeErosionSteps; step++) {
+			dispatch(PIPE_PASS_FLUX);
+			dispatch(PIPE_PASS_WATER);
+			dispatch(PIPE_PASS_EROSION);
+			terrainIn = 1 - terrainIn;
+			sedimentIn = 1 - sedimentIn;
+			bindBuffers(terrainIn, sedimentIn);
+			dispatch(PIPE_PASS_TRANSPORT);
+			sedimentIn = 1 - sedimentIn;
+			bindBuffers(terrainIn, sedimentIn);
+		}
+
+		dispatch(PIPE_PASS_WRITEBACK);
+		glMemoryBarrier(GL_ALL_BARRIER_BITS);
+	}
+
+	~PipeErosionComputeShader() {
+		glDeleteBuffers(2, terrainBuffers);
+		glDeleteBuffers(2, sedimentBuffers);
+		glDeleteBuffers(1, &waterBuffer);
+		glDeleteBuffers(1, &fluxBuffer);
+		glDeleteBuffers(1, &velocityBuffer);
+	}
+};
@@ -1,16 +1,49 @@
 #pragma once
 #include "geometry.h"
 
-class Plane : public Geometry {
+bool gridVertexPulling = false;     // shaders compute the grid from gl_VertexID and gl_InstanceID
+int gridTesselation = 256;          // pulled grid only, the vertex buffer keeps its build resolution
+
+class Plane : public SurfaceGeometry<Plane> {
     float scale;
     int tesselation;
-public:
-
+    unsigned int emptyVao;          // no attributes, for vertex pulling
+    int vertexGrid = 0;             // quads per side with GridVertex, 0 with VertexData
 
+public:
     Plane(int _tesselation, float _scale) {
         scale = _scale;
         tesselation = _tesselation;
-        create(tesselation, tesselation);
+        if (geometryCompactVertices && tesselation <= 0xFFFF) {
+            vertexGrid = tesselation;
+            createGrid<GridVertex>(tesselation, tesselation, [&](int i, GridVertex* vd) {
+                for (int j = 0; j <= vertexGrid; j++, vd++) *vd = { (unsigned short)j, (unsigned short)i };
+            });
+        } else {
+            create(tesselation, tesselation);
+        }
+        glGenVertexArrays(1, &emptyVao);
+    }
+
+    // One instance per row strip, the vertex shader rebuilds eval() from the vertex and instance id
+    void Draw(Shader& shader) {
+        setProgramUniform(shader, "vertexPulling", gridVertexPulling ? 1 : 0);
+        setProgramUniform(shader, "lodPatch", 0);
+        if (!gridVertexPulling) {
+            setProgramUniform(shader, "vertexGrid", vertexGrid);
+            setProgramUniform(shader, "gridScale", scale);
+            Geometry::Draw(shader);
+            return;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        setProgramUniform(shader, "gridTesselation", gridTesselation);
+        setProgramUniform(shader, "gridScale", scale);
+        glBindVertexArray(emptyVao);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, (gridTesselation + 1) * 2, gridTesselation);
+        geometryStats.drawCalls++;
+        geometryStats.triangles += 2LL * gridTesselation * gridTesselation;
+        geometryStats.drawMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
     }
 
     void eval(float u, float v, vec3& pos) {
@@ -19,4 +52,6 @@ public:
 
         pos = vec3(U, 0, V);
     }
+
+    ~Plane() { glDeleteVertexArrays(1, &emptyVao); }
 };
\ No newline at end of file
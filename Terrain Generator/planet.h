@@ -0,0 +1,540 @@
+#pragma once
+#include "framework.h"
+#include "geometry.h"
+#include "camera.h"
+#include "frustum.h"
+#include "renderstate.h"
+#include "FastNoiseLite.h"
+#include <future>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+
+bool planetMode = false;
+float planetPixelError = 6.0f;		// largest vertex spacing on screen before a chunk splits
+int planetWorkers = 4;				// chunk builds running at once
+int planetUploadsPerFrame = 8;		// finished chunks copied to the GPU per frame
+bool planetFrustumCulling = true;
+bool planetHorizonCulling = true;
+
+const double PLANET_RADIUS = 6371000.0;		// sea level, scene units are meters in planet mode
+const double PLANET_AMPLITUDE = 8000.0;		// highest mountains
+const int PLANET_OCTAVES = 16;				// the finest has a wave length of about 100 m
+const int PLANET_CHUNK_GRID = 32;			// quads per chunk side
+const int PLANET_MAX_LEVEL = 18;			// about 1 m between the vertices
+const int PLANET_CACHE_CHUNKS = 4096;		// chunks kept on the GPU before the least recently used go
+
+// Planet of the last frame
+struct PlanetStats {
+	int drawn = 0;
+	int cached = 0;
+	int culledFrustum = 0;			// subtrees skipped, each counted once
+	int culledHorizon = 0;
+	int deepestLevel = 0;
+	int building = 0;				// on the workers
+	int waiting = 0;				// built, waiting for their upload
+	int uploads = 0;
+	long long generated = 0;
+	double buildMs = 0;				// worker time of the last chunk
+	double updateMs = 0;			// render thread: uploads, selection and new builds
+	double altitude = 0;
+};
+
+PlanetStats planetStats;
+
+// Double precision vector for planet positions, only the render thread's offsets to the eye go to
+// the GPU, and those are small where precision matters
+struct dvec3 {
+	double x, y, z;
+
+	dvec3(double x0 = 0, double y0 = 0, double z0 = 0) { x = x0; y = y0; z = z0; }
+	dvec3(const vec3& v) { x = v.x; y = v.y; z = v.z; }
+	dvec3 operator+(const dvec3& v) const { return dvec3(x + v.x, y + v.y, z + v.z); }
+	dvec3 operator-(const dvec3& v) const { return dvec3(x - v.x, y - v.y, z - v.z); }
+	dvec3 operator*(double a) const { return dvec3(x * a, y * a, z * a); }
+	vec3 toVec3() const { return vec3((float)x, (float)y, (float)z); }
+};
+
+inline double dot(const dvec3& v1, const dvec3& v2) { return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z; }
+inline double length(const dvec3& v) { return sqrt(dot(v, v)); }
+inline dvec3 normalize(const dvec3& v) { return v * (1.0 / length(v)); }
+
+// Height above the sea from 3D noise on the unit sphere, negative under the sea. FastNoiseLite
+// keeps the double coordinates, so the finest octaves do not break up at this radius.
+class PlanetNoise {
+	FastNoiseLite noise;
+
+public:
+	PlanetNoise(int seed) {
+		noise.SetNoiseType(FastNoiseLite::NoiseType_OpenSimplex2);
+		noise.SetSeed(seed);
+		noise.SetFrequency(1);
+	}
+
+	double height(const dvec3& direction) const {
+		double h = 0, amplitude = 1, frequency = 1.5, total = 0;
+		for (int i = 0; i < PLANET_OCTAVES; i++) {
+			h += noise.GetNoise(direction.x * frequency, direction.y * frequency, direction.z * frequency) * amplitude;
+			total += amplitude;
+			amplitude *= 0.5;
+			frequency *= 2.0;
+		}
+		return h / total * 2.0 * PLANET_AMPLITUDE;
+	}
+};
+
+// Cube faces as normal, u and v axes with u x v = normal
+const dvec3 PLANET_FACES[6][3] = {
+	{ dvec3(1, 0, 0), dvec3(0, 0, -1), dvec3(0, 1, 0) },
+	{ dvec3(-1, 0, 0), dvec3(0, 0, 1), dvec3(0, 1, 0) },
+	{ dvec3(0, 1, 0), dvec3(1, 0, 0), dvec3(0, 0, -1) },
+	{ dvec3(0, -1, 0), dvec3(1, 0, 0), dvec3(0, 0, 1) },
+	{ dvec3(0, 0, 1), dvec3(1, 0, 0), dvec3(0, 1, 0) },
+	{ dvec3(0, 0, -1), dvec3(-1, 0, 0), dvec3(0, 1, 0) },
+};
+
+// Point of face at u, v in [-1, 1] on the unit sphere, spread more evenly than by normalizing the
+// cube point (the mapping of Philip Nowell)
+inline dvec3 cubeToSphere(int face, double u, double v) {
+	dvec3 p = PLANET_FACES[face][0] + PLANET_FACES[face][1] * u + PLANET_FACES[face][2] * v;
+	double x2 = p.x * p.x, y2 = p.y * p.y, z2 = p.z * p.z;
+	return dvec3(p.x * sqrt(1.0 - y2 / 2.0 - z2 / 2.0 + y2 * z2 / 3.0),
+		p.y * sqrt(1.0 - z2 / 2.0 - x2 / 2.0 + z2 * x2 / 3.0),
+		p.z * sqrt(1.0 - x2 / 2.0 - y2 / 2.0 + x2 * y2 / 3.0));
+}
+
+// Cube-sphere planet drawn as chunked LOD: every face is a quadtree of chunks with the same grid, a
+// chunk splits into its four children when its vertex spacing covers more than planetPixelError pixels.
+// Chunks are built on worker threads, copied to the GPU a few per frame and kept in a cache, and a
+// parent is drawn until all four children are there, so the render thread never waits for a build.
+// Skirts hanging from the chunk borders hide the cracks between levels.
+//
+// Positions are relative to the chunk center, and the center minus the eye is computed in double
+// precision every frame. The camera stays at the origin, its moves are added to the planet's eye, so
+// nothing the GPU gets is as large as the planet.
+class Planet : public Geometry {
+	struct ChunkBuild {
+		uint64_t key;
+		dvec3 center;
+		vec3 boxMin, boxMax;		// relative to the center
+		std::vector<VertexData> vertices;
+		double ms = 0;
+	};
+
+	struct Chunk {
+		dvec3 center;
+		vec3 boxMin, boxMax;
+		unsigned int buffer;
+		int lastFrame;
+	};
+
+	struct Request {
+		uint64_t key;
+		int level;
+		float distance;
+	};
+
+	PlanetNoise noise;
+	dvec3 eye = dvec3(0, 3.0 * PLANET_RADIUS, 0);
+	vec3 savedEye, savedDir;		// of the terrain camera, while in planet mode
+	int frame = 0;
+	int indexCount = 0;
+
+	std::unordered_map<uint64_t, Chunk> chunks;
+	std::unordered_set<uint64_t> pending;			// building or waiting for the upload
+	std::vector<std::future<ChunkBuild>> jobs;
+	std::vector<ChunkBuild> built;
+	std::vector<unsigned int> freeBuffers;
+	std::vector<Request> requests;
+	std::vector<const Chunk*> drawList;
+	Frustum frustum;
+	float pixelsPerRadian = 1;
+
+	static const int CHUNK_VERTICES = (PLANET_CHUNK_GRID + 1) * (PLANET_CHUNK_GRID + 5);
+
+	static uint64_t chunkKey(int face, int level, int x, int y) {
+		return ((uint64_t)face << 61) | ((uint64_t)level << 56) | ((uint64_t)x << 28) | (uint64_t)y;
+	}
+
+	// Distance between the vertices of a chunk, on the sphere at sea level
+	static double chunkSpacing(int level) {
+		return 0.5 * M_PI * PLANET_RADIUS / (1 << level) / PLANET_CHUNK_GRID;
+	}
+
+	// Worker thread: vertices of the grid and then of the four skirts, the skirts a few vertex spacings
+	// below the border. tex.x is the height above the sea, which the sea surface is clamped to.
+	static ChunkBuild buildChunk(const PlanetNoise& noise, uint64_t key) {
+		auto start = std::chrono::high_resolution_clock::now();
+		int face = (int)(key >> 61), level = (int)((key >> 56) & 31);
+		int x = (int)((key >> 28) & 0xFFFFFFF), y = (int)(key & 0xFFFFFFF);
+		const int G = PLANET_CHUNK_GRID;
+		double size = 2.0 / (1 << level);
+		double u0 = -1.0 + x * size, v0 = -1.0 + y * size;
+
+		ChunkBuild build;
+		build.key = key;
+		build.center = cubeToSphere(face, u0 + 0.5 * size, v0 + 0.5 * size) * PLANET_RADIUS;
+		build.vertices.resize(CHUNK_VERTICES);
+		std::vector<dvec3> directions((G + 1) * (G + 1));
+		std::vector<double> radii((G + 1) * (G + 1));
+		vec3 lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		auto put = [&](int index, const dvec3& position, float height) {
+			VertexData& vd = build.vertices[index];
+			vd.pos = (position - build.center).toVec3();
+			vd.tex = vec2(height, 0);
+			lo = vec3(min(lo.x, vd.pos.x), min(lo.y, vd.pos.y), min(lo.z, vd.pos.z));
+			hi = vec3(max(hi.x, vd.pos.x), max(hi.y, vd.pos.y), max(hi.z, vd.pos.z));
+		};
+		for (int i = 0; i <= G; i++) {
+			for (int j = 0; j <= G; j++) {
+				int index = i * (G + 1) + j;
+				dvec3 direction = cubeToSphere(face, u0 + size * j / G, v0 + size * i / G);
+				double h = noise.height(direction);
+				directions[index] = direction;
+				radii[index] = PLANET_RADIUS + max(h, 0.0);
+				put(index, direction * radii[index], (float)h);
+			}
+		}
+		double skirt = 4.0 * chunkSpacing(level);
+		for (int k = 0; k <= G; k++) {
+			int border[4] = { k, G * (G + 1) + k, k * (G + 1), k * (G + 1) + G };
+			for (int side = 0; side < 4; side++) {
+				int index = border[side];
+				put((G + 1) * (G + 1) + side * (G + 1) + k, directions[index] * (radii[index] - skirt), build.vertices[index].tex.x);
+			}
+		}
+		build.boxMin = lo;
+		build.boxMax = hi;
+		build.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return build;
+	}
+
+	// Whether the box of the chunk is entirely behind the sea level sphere, seen from the eye (the
+	// horizon test of Cesium in units of the radius). The points hidden by the sphere form a convex
+	// set beyond the horizon plane, so the box corners being hidden hides the chunk.
+	bool belowHorizon(const Chunk& chunk) {
+		dvec3 camera = eye * (1.0 / PLANET_RADIUS);
+		double horizon2 = dot(camera, camera) - 1.0;
+		if (horizon2 <= 0.0) return false;
+		for (int i = 0; i < 8; i++) {
+			dvec3 corner(i & 1 ? chunk.boxMax.x : chunk.boxMin.x, i & 2 ? chunk.boxMax.y : chunk.boxMin.y, i & 4 ? chunk.boxMax.z : chunk.boxMin.z);
+			dvec3 toCorner = (chunk.center + corner) * (1.0 / PLANET_RADIUS) - camera;
+			double along = -dot(toCorner, camera);
+			if (along <= horizon2 || along * along / dot(toCorner, toCorner) <= horizon2) return false;
+		}
+		return true;
+	}
+
+	void select(int face, int level, int x, int y, int planeMask) {
+		auto found = chunks.find(chunkKey(face, level, x, y));
+		if (found == chunks.end()) {
+			if (level == 0) requests.push_back({ chunkKey(face, level, x, y), level, 0.0f });
+			return;
+		}
+		Chunk& chunk = found->second;
+		chunk.lastFrame = frame;
+
+		vec3 offset = (chunk.center - eye).toVec3();
+		vec3 center = offset + 0.5f * (chunk.boxMin + chunk.boxMax);
+		vec3 extent = 0.5f * (chunk.boxMax - chunk.boxMin);
+		if (planetFrustumCulling && frustum.test(center, extent, planeMask) == FRUSTUM_OUTSIDE) {
+			planetStats.culledFrustum++;
+			return;
+		}
+		if (planetHorizonCulling && belowHorizon(chunk)) {
+			planetStats.culledHorizon++;
+			return;
+		}
+
+		vec3 outside(max(fabsf(center.x) - extent.x, 0.0f), max(fabsf(center.y) - extent.y, 0.0f), max(fabsf(center.z) - extent.z, 0.0f));
+		float distance = max(length(outside), 1e-3f);
+		if (level < PLANET_MAX_LEVEL && chunkSpacing(level) * pixelsPerRadian / distance > planetPixelError) {
+			bool ready = true;
+			for (int c = 0; c < 4; c++) {
+				uint64_t child = chunkKey(face, level + 1, 2 * x + (c & 1), 2 * y + (c >> 1));
+				if (chunks.count(child) == 0) {
+					ready = false;
+					if (pending.count(child) == 0) requests.push_back({ child, level + 1, distance });
+				}
+			}
+			if (ready) {
+				for (int c = 0; c < 4; c++) select(face, level + 1, 2 * x + (c & 1), 2 * y + (c >> 1), planeMask);
+				return;
+			}
+		}
+		drawList.push_back(&chunk);
+		planetStats.deepestLevel = max(planetStats.deepestLevel, level);
+	}
+
+	void upload(ChunkBuild& build) {
+		unsigned int buffer;
+		if (!freeBuffers.empty()) {
+			buffer = freeBuffers.back();
+			freeBuffers.pop_back();
+		} else {
+			glCreateBuffers(1, &buffer);
+			glNamedBufferStorage(buffer, CHUNK_VERTICES * sizeof(VertexData), nullptr, GL_DYNAMIC_STORAGE_BIT);
+		}
+		glNamedBufferSubData(buffer, 0, build.vertices.size() * sizeof(VertexData), build.vertices.data());
+		chunks[build.key] = { build.center, build.boxMin, build.boxMax, buffer, frame };
+		pending.erase(build.key);
+		planetStats.buildMs = build.ms;
+		planetStats.generated++;
+	}
+
+	// Least recently drawn chunks above the cache size give their buffers back, the roots stay
+	void evict() {
+		if ((int)chunks.size() <= PLANET_CACHE_CHUNKS) return;
+		std::vector<std::pair<int, uint64_t>> unused;
+		for (auto& entry : chunks) {
+			if (entry.second.lastFrame < frame && ((entry.first >> 56) & 31) != 0) unused.push_back({ entry.second.lastFrame, entry.first });
+		}
+		size_t count = min(unused.size(), chunks.size() - PLANET_CACHE_CHUNKS);
+		std::partial_sort(unused.begin(), unused.begin() + count, unused.end());
+		for (size_t i = 0; i < count; i++) {
+			freeBuffers.push_back(chunks[unused[i].second].buffer);
+			chunks.erase(unused[i].second);
+		}
+	}
+
+public:
+	Planet(int seed) : noise(seed) {
+		// One index buffer for all chunks: the grid, then a quad strip between each border and its skirt
+		const int G = PLANET_CHUNK_GRID;
+		std::vector<unsigned int> indices;
+		for (int i = 0; i < G; i++) {
+			for (int j = 0; j < G; j++) {
+				unsigned int a = i * (G + 1) + j;
+				indices.insert(indices.end(), { a, a + G + 1, a + 1, a + 1, a + G + 1, a + G + 2 });
+			}
+		}
+		for (int k = 0; k < G; k++) {
+			unsigned int border[4][2] = { { (unsigned)k, (unsigned)k + 1 }, { (unsigned)(G * (G + 1) + k), (unsigned)(G * (G + 1) + k + 1) },
+				{ (unsigned)(k * (G + 1)), (unsigned)((k + 1) * (G + 1)) }, { (unsigned)(k * (G + 1) + G), (unsigned)((k + 1) * (G + 1) + G) } };
+			for (int side = 0; side < 4; side++) {
+				unsigned int s = (G + 1) * (G + 1) + side * (G + 1) + k;
+				indices.insert(indices.end(), { border[side][0], s, border[side][1], border[side][1], s, s + 1 });
+			}
+		}
+		indexCount = (int)indices.size();
+
+		// Attributes come from the buffer of the chunk being drawn
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+		glEnableVertexArrayAttrib(vao, 0); // AttArr 0 = POSITION
+		glEnableVertexArrayAttrib(vao, 1); // AttArr 1 = UV
+		glVertexArrayAttribFormat(vao, 0, 3, GL_FLOAT, GL_FALSE, offsetof(VertexData, pos));
+		glVertexArrayAttribFormat(vao, 1, 2, GL_FLOAT, GL_FALSE, offsetof(VertexData, tex));
+		glVertexArrayAttribBinding(vao, 0, 0);
+		glVertexArrayAttribBinding(vao, 1, 0);
+		glBindVertexArray(0);
+	}
+
+	~Planet() {
+		for (auto& job : jobs) job.wait();
+		for (auto& entry : chunks) glDeleteBuffers(1, &entry.second.buffer);
+		if (!freeBuffers.empty()) glDeleteBuffers((int)freeBuffers.size(), freeBuffers.data());
+	}
+
+	// Ground under a direction, at least the sea
+	double groundRadius(const dvec3& direction) const {
+		return PLANET_RADIUS + max(noise.height(direction), 0.0);
+	}
+
+	double altitude() const {
+		return length(eye) - groundRadius(normalize(eye));
+	}
+
+	const PlanetNoise& getNoise() const { return noise; }
+
+	void setEye(const dvec3& _eye) { eye = _eye; }
+
+	// Clip planes for the altitude: the far plane at the horizon of the highest mountains
+	float nearPlane() const { return (float)min(max(0.25 * altitude(), 0.1), 10000.0); }
+
+	float farPlane() const {
+		double r = length(eye);
+		return (float)(sqrt(max(r * r - PLANET_RADIUS * PLANET_RADIUS, 0.0)) + sqrt(2.0 * PLANET_RADIUS * PLANET_AMPLITUDE + PLANET_AMPLITUDE * PLANET_AMPLITUDE));
+	}
+
+	// Switches the camera between the terrain and the planet, which keeps its own eye
+	void enter(Camera& camera) {
+		savedEye = camera.getEyePos();
+		savedDir = camera.getEyeDir();
+		camera.setEyePos(vec3(0, 0, 0));
+		camera.setEyeDir((dvec3(0, 0, 0) - eye).toVec3() + vec3(0.2f * (float)PLANET_RADIUS, 0, 0));
+	}
+
+	void leave(Camera& camera) {
+		camera.setEyePos(savedEye);
+		camera.setEyeDir(savedDir);
+		camera.setClipPlanes(0.1f, 500.0f);
+	}
+
+	// The camera moved from the origin: the move goes to the eye, faster the higher it is, and the
+	// camera goes back to the origin. The eye stays above the ground.
+	void moveEye(Camera& camera) {
+		double speed = max(1.0, 0.02 * altitude());
+		eye = eye + dvec3(camera.getEyePos()) * speed;
+		camera.setEyePos(vec3(0, 0, 0));
+		dvec3 up = normalize(eye);
+		double ground = groundRadius(up) + 2.0;
+		if (length(eye) < ground) eye = up * ground;
+	}
+
+	// Once per frame before drawing: uploads finished chunks, selects the chunks to draw and starts the
+	// builds they are waiting for, the coarsest and nearest first
+	void update(const RenderState& state, float fov, int viewportHeight) {
+		auto start = std::chrono::high_resolution_clock::now();
+		frame++;
+		for (size_t i = 0; i < jobs.size();) {
+			if (jobs[i].wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+				built.push_back(jobs[i].get());
+				jobs.erase(jobs.begin() + i);
+			} else {
+				i++;
+			}
+		}
+		int uploads = min((int)built.size(), max(1, planetUploadsPerFrame));
+		for (int i = 0; i < uploads; i++) upload(built[i]);
+		built.erase(built.begin(), built.begin() + uploads);
+
+		planetStats.culledFrustum = planetStats.culledHorizon = planetStats.deepestLevel = 0;
+		frustum.update(state.V, state.P);
+		pixelsPerRadian = 0.5f * viewportHeight / tanf(0.5f * fov * (float)M_PI / 180.0f);
+		drawList.clear();
+		requests.clear();
+		for (int face = 0; face < 6; face++) select(face, 0, 0, 0, FRUSTUM_ALL_PLANES);
+
+		std::sort(requests.begin(), requests.end(), [](const Request& a, const Request& b) {
+			return a.level != b.level ? a.level < b.level : a.distance < b.distance;
+		});
+		for (const Request& request : requests) {
+			if ((int)jobs.size() >= max(1, planetWorkers)) break;
+			if (pending.count(request.key) != 0) continue;
+			pending.insert(request.key);
+			uint64_t key = request.key;
+			jobs.push_back(std::async(std::launch::async, [this, key]() { return buildChunk(noise, key); }));
+		}
+		evict();
+
+		planetStats.drawn = (int)drawList.size();
+		planetStats.cached = (int)chunks.size();
+		planetStats.building = (int)jobs.size();
+		planetStats.waiting = (int)built.size();
+		planetStats.uploads = uploads;
+		planetStats.altitude = altitude();
+		planetStats.updateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	void Draw(Shader& shader) {
+		auto start = std::chrono::high_resolution_clock::now();
+		int offsetLocation = shader.uniformLocation("chunkOffset");
+		vec3 planetCenter = (dvec3(0, 0, 0) - eye).toVec3();
+		glUniform3f(shader.uniformLocation("planetCenter"), planetCenter.x, planetCenter.y, planetCenter.z);
+		setProgramUniform(shader, "farPlane", farPlane());
+
+		glBindVertexArray(vao);
+		for (const Chunk* chunk : drawList) {
+			vec3 offset = (chunk->center - eye).toVec3();
+			glUniform3f(offsetLocation, offset.x, offset.y, offset.z);
+			glVertexArrayVertexBuffer(vao, 0, chunk->buffer, 0, sizeof(VertexData));
+			glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, nullptr);
+		}
+		geometryStats.drawCalls += (int)drawList.size();
+		geometryStats.triangles += (long long)drawList.size() * indexCount / 3;
+		geometryStats.drawMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+};
+
+// Summary of the last descent
+struct PlanetDescentStats {
+	int frames = 0;
+	double averageMs = 0;
+	double maxMs = 0;
+	double p99Ms = 0;
+	int spikes = 0;					// frames over twice the median
+	double maxUpdateMs = 0;			// render thread time of the planet
+};
+
+PlanetDescentStats planetDescentStats;
+
+// Fixed descent from orbit to a few meters above the highest ground near the +Y face center, one step
+// per frame with the altitude falling exponentially, while the view turns from down to the horizon.
+// Frames are timed from one Render call to the next as in the flythrough.
+class PlanetDescent {
+	const int frames = 900;
+	const double startAltitude = 2.0 * PLANET_RADIUS;
+	const double endAltitude = 20.0;
+
+	int frame = -1;
+	dvec3 target;
+	std::chrono::high_resolution_clock::time_point last;
+	std::vector<double> frameMs;
+	double maxUpdateMs = 0;
+
+public:
+	bool active() { return frame >= 0; }
+
+	void start(const Planet& planet) {
+		double best = -DBL_MAX;
+		for (int i = 0; i < 8; i++) {
+			for (int j = 0; j < 8; j++) {
+				dvec3 direction = cubeToSphere(2, -0.3 + 0.6 * i / 7, -0.3 + 0.6 * j / 7);
+				double h = planet.getNoise().height(direction);
+				if (h > best) {
+					best = h;
+					target = direction;
+				}
+			}
+		}
+		frame = 0;
+		frameMs.clear();
+		maxUpdateMs = 0;
+	}
+
+	// Before the frame is rendered, records the previous one and places the eye
+	void update(Planet& planet, Camera& camera) {
+		if (!active()) return;
+		auto now = std::chrono::high_resolution_clock::now();
+		if (frame > 0) {
+			frameMs.push_back(std::chrono::duration<double, std::milli>(now - last).count());
+			maxUpdateMs = max(maxUpdateMs, planetStats.updateMs);
+		}
+		last = now;
+		if (frame == frames) {
+			finish();
+			return;
+		}
+
+		double t = (double)frame / (frames - 1);
+		double altitude = exp(log(startAltitude) * (1.0 - t) + log(endAltitude) * t);
+		planet.setEye(target * (planet.groundRadius(target) + altitude));
+		dvec3 forward = normalize(dvec3(target.y, -target.x, 0));
+		double pitch = (80.0 - 70.0 * t) * M_PI / 180.0;
+		camera.setEyePos(vec3(0, 0, 0));
+		camera.setEyeDir((forward * cos(pitch) - target * sin(pitch)).toVec3());
+		frame++;
+	}
+
+	void finish() {
+		frame = -1;
+		planetDescentStats = PlanetDescentStats();
+		planetDescentStats.frames = (int)frameMs.size();
+		planetDescentStats.maxUpdateMs = maxUpdateMs;
+		if (frameMs.empty()) return;
+		std::vector<double> sorted = frameMs;
+		std::sort(sorted.begin(), sorted.end());
+		double median = sorted[sorted.size() / 2];
+		for (double ms : frameMs) {
+			planetDescentStats.averageMs += ms;
+			if (ms > 2.0 * median) planetDescentStats.spikes++;
+		}
+		planetDescentStats.averageMs /= frameMs.size();
+		planetDescentStats.maxMs = sorted.back();
+		planetDescentStats.p99Ms = sorted[min(sorted.size() - 1, sorted.size() * 99 / 100)];
+		printf("descent: %d frames, %.2f ms average, %.2f ms 99th percentile, %.2f ms max, %d over twice the median, planet update max %.2f ms\n",
+			planetDescentStats.frames, planetDescentStats.averageMs, planetDescentStats.p99Ms, planetDescentStats.maxMs, planetDescentStats.spikes, maxUpdateMs);
+	}
+};
@@ -0,0 +1,98 @@
+#pragma once
+#include "framework.h"
+#include "shader.h"
+#include "renderstate.h"
+
+// Planet chunks. The vertex stage adds the chunk offset to the eye, so MVP only rotates and projects,
+// and writes a logarithmic depth, which keeps the ground a meter away and the horizon thousands of
+// kilometers away apart with the same depth buffer. The fragment stage colors by the height above the
+// sea and the slope, and lights with a sun far away.
+class PlanetShader : public Shader {
+	const char* vertexSource = R"(
+		#version 450 core
+		precision highp float;
+
+		#include <uniformblocks>
+
+		uniform vec3  chunkOffset;		// chunk center relative to the eye
+		uniform vec3  planetCenter;		// relative to the eye
+		uniform float farPlane;
+
+		layout(location = 0) in vec3  vtxPos;		// relative to the chunk center
+		layout(location = 1) in vec2  vtxUV;		// height above the sea
+
+		out vec3 wView;
+		out vec3 up;
+		out float height;
+		out float distance;
+
+		void main() {
+			vec3 p = vtxPos + chunkOffset;
+			gl_Position = vec4(p, 1) * MVP;
+			gl_Position.z = (2.0 * log(max(1e-6, gl_Position.w + 1.0)) / log(farPlane + 1.0) - 1.0) * gl_Position.w;
+			wView = -p;
+			up = normalize(p - planetCenter);
+			height = vtxUV.x;
+			distance = length(p);
+		}
+	)";
+
+	const char* fragmentSource = R"(
+	#version 450 core
+	precision highp float;
+
+	#include <uniformblocks>
+
+	uniform float farPlane;
+
+	in vec3 wView;
+	in vec3 up;
+	in float height;
+	in float distance;
+
+	out vec4 fragmentColor;
+
+	vec3 deepColor = vec3(0.02, 0.1, 0.3);
+	vec3 shallowColor = vec3(0.1, 0.35, 0.6);
+	vec3 sandColor = vec3(0.76, 0.7, 0.5);
+	vec3 grassColor = vec3(0.1, 0.4, 0.1);
+	vec3 rockColor = vec3(0.4, 0.37, 0.33);
+	vec3 snowColor = vec3(0.95, 0.95, 1.0);
+	vec3 sunDirection = normalize(vec3(0.5, 1.0, 0.3));
+
+	void main() {
+		vec3 N = normalize(cross(dFdx(wView), dFdy(wView)));
+		vec3 U = normalize(up);
+		if (dot(N, U) < 0.0) N = -N;
+
+		vec3 texColor;
+		if (height <= 0.0) {
+			texColor = mix(shallowColor, deepColor, clamp(-height / 4000.0, 0.0, 1.0));
+			N = U;
+		} else {
+			float slope = dot(N, U);
+			texColor = mix(sandColor, grassColor, smoothstep(20.0, 60.0, height));
+			texColor = mix(rockColor, texColor, smoothstep(0.7, 0.85, slope));
+			texColor = mix(texColor, snowColor, smoothstep(3500.0, 4500.0, height) * smoothstep(0.6, 0.75, slope));
+		}
+
+		vec3 ka = material.ka * texColor;
+		vec3 kd = material.kd * texColor;
+		vec3 radiance = ka * lights[0].La + kd * max(dot(N, sunDirection), 0.0) * lights[0].Le;
+
+		// Haze over the distance to the horizon
+		float haze = 1.0 - exp(-3.0 * distance / farPlane);
+		fragmentColor = vec4(mix(radiance, fogColor, haze * 0.6), 1.0);
+	}
+)";
+
+public:
+	PlanetShader() {
+		create(vertexSource, fragmentSource, "fragmentColor");
+	}
+
+	// The sun is the first light of the light block
+	void Bind(RenderState) {
+		Use();
+	}
+};
@@ -0,0 +1,221 @@
+#pragma once
+#include "framework.h"
+#include <queue>
+
+bool lakes = true;
+float lakeMinDepth = 0.004;		// normalized height, shallower depressions stay dry
+
+// Results of the last depression filling run
+struct LakeStats {
+	double fillMs = 0;
+	double uploadMs = 0;
+	int basins = 0;			// depressions found, including dry ones
+	int lakes = 0;			// depressions deeper than lakeMinDepth
+	int lakeCells = 0;
+	float maxLevel = 0;		// highest lake surface, normalized
+};
+
+LakeStats lakeStats;
+
+// Monotone priority queue (radix heap). Keys pushed are never below the last key popped, which holds
+// for the flood, so a push is O(1) and every entry moves between at most 33 buckets over its lifetime.
+class RadixHeap {
+	typedef std::pair<unsigned int, int> Entry;		// ordered key, cell
+	std::vector<Entry> buckets[33];
+	unsigned int last = 0;
+	size_t count = 0;
+
+	// Float bits reordered so that unsigned comparison matches float comparison
+	static unsigned int orderedKey(float f) {
+		unsigned int bits;
+		memcpy(&bits, &f, sizeof(bits));
+		return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+	}
+
+	// 0 for the last key, otherwise one more than the highest bit in which the key differs from it
+	int bucket(unsigned int key) {
+		unsigned int diff = key ^ last;
+		int b = 0;
+		if (diff >= 1u << 16) { diff >>= 16; b += 16; }
+		if (diff >= 1u << 8) { diff >>= 8; b += 8; }
+		if (diff >= 1u << 4) { diff >>= 4; b += 4; }
+		while (diff) { diff >>= 1; b++; }
+		return b;
+	}
+
+public:
+	bool empty() { return count == 0; }
+
+	void push(float key, int cell) {
+		unsigned int k = orderedKey(key);
+		buckets[bucket(k)].push_back(Entry(k, cell));
+		count++;
+	}
+
+	int pop() {
+		if (buckets[0].empty()) {
+			int b = 1;
+			while (buckets[b].empty()) b++;
+			last = buckets[b][0].first;
+			for (const Entry& entry : buckets[b]) last = min(last, entry.first);
+			for (const Entry& entry : buckets[b]) buckets[bucket(entry.first)].push_back(entry);
+			buckets[b].clear();
+		}
+		int cell = buckets[0].back().second;
+		buckets[0].pop_back();
+		count--;
+		return cell;
+	}
+};
+
+// Priority-flood depression filling (Barnes et al., with the FIFO for depression cells and the slope
+// tracing of Zhou et al.). The flood starts at the map edge and always grows from the lowest open
+// cell. A neighbour below the current water level lies in a depression, so it is filled to that level
+// and flooded through a FIFO. A neighbour on rising ground whose unvisited neighbours are all higher
+// cannot spill anywhere, so it also skips the heap. Only the remaining cells go through the heap,
+// which keeps the run close to linear. A depression is labelled when the flood first spills into it,
+// and the height of the rim cell it spilled over is the spill height of the basin.
+class PriorityFlood {
+	int width, height, stride;
+	int offsets[8];
+
+	// Working copies with a one cell border that is closed from the start, so neighbours need no
+	// bounds checks and heights are read from a dense array
+	std::vector<float> terrain, level;
+	std::vector<int> label;
+	std::vector<unsigned char> closed;
+
+	int padded(int x, int y) { return (y + 1) * stride + x + 1; }
+
+	// Whether a cell has an unvisited neighbour at or below its height
+	bool hasLowerOpenNeighbour(int i) {
+		for (int offset : offsets) {
+			if (!closed[i + offset] && terrain[i + offset] <= terrain[i]) return true;
+		}
+		return false;
+	}
+
+public:
+	std::vector<float> filled;		// height with every depression filled to its spill height
+	std::vector<int> basin;			// 0 outside depressions
+	std::vector<float> basinSpill;	// per basin, index 0 unused
+	std::vector<float> basinDepth;
+
+	PriorityFlood(int _width, int _height) {
+		width = _width;
+		height = _height;
+		stride = width + 2;
+		int neighbourOffsets[8] = { -stride - 1, -stride, -stride + 1, -1, 1, stride - 1, stride, stride + 1 };
+		std::copy(neighbourOffsets, neighbourOffsets + 8, offsets);
+		filled.resize(width * height);
+		basin.resize(width * height);
+	}
+
+	void fill(const std::vector<vec4>& image) {
+		RadixHeap open;
+		std::queue<int> pit, slope;
+		terrain.assign(stride * (height + 2), 0.0f);
+		level.assign(stride * (height + 2), 0.0f);
+		label.assign(stride * (height + 2), 0);
+		closed.assign(stride * (height + 2), 1);
+		basinSpill.assign(1, 0.0f);
+		basinDepth.assign(1, 0.0f);
+
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				int i = padded(x, y);
+				terrain[i] = image[y * width + x].x;
+				if (x > 0 && x < width - 1 && y > 0 && y < height - 1) {
+					closed[i] = 0;
+				} else {
+					level[i] = terrain[i];
+					open.push(level[i], i);
+				}
+			}
+		}
+
+		while (!open.empty() || !pit.empty() || !slope.empty()) {
+			int c;
+			if (!pit.empty()) {
+				c = pit.front();
+				pit.pop();
+			} else if (!slope.empty()) {
+				c = slope.front();
+				slope.pop();
+			} else {
+				c = open.pop();
+			}
+
+			// A rim cell opens at most one new basin, depressions it spills into share its level
+			int basinLabel = label[c];
+			for (int offset : offsets) {
+				int n = c + offset;
+				if (closed[n]) continue;
+				closed[n] = 1;
+
+				float h = terrain[n];
+				if (h <= level[c]) {
+					if (basinLabel == 0) {
+						basinLabel = (int)basinSpill.size();
+						basinSpill.push_back(level[c]);
+						basinDepth.push_back(0.0f);
+					}
+					level[n] = level[c];
+					label[n] = basinLabel;
+					basinDepth[basinLabel] = max(basinDepth[basinLabel], level[c] - h);
+					pit.push(n);
+				} else {
+					level[n] = h;
+					if (hasLowerOpenNeighbour(n)) open.push(h, n);
+					else slope.push(n);
+				}
+			}
+		}
+
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				filled[y * width + x] = level[padded(x, y)];
+				basin[y * width + x] = label[padded(x, y)];
+			}
+		}
+	}
+
+	// Water surface per cell for the renderer: the spill height inside lakes, 0 elsewhere. Dry cells
+	// next to a lake that are not below its surface get the lake level too, so that the water mesh
+	// stays level up to the shore instead of sloping down to the sea level between two samples.
+	void lakeLevels(const std::vector<vec4>& image, std::vector<float>& levels) {
+		levels.assign(width * height, 0.0f);
+		lakeStats.basins = (int)basinSpill.size() - 1;
+		lakeStats.lakes = 0;
+		lakeStats.lakeCells = 0;
+		lakeStats.maxLevel = 0;
+		for (int b = 1; b < (int)basinSpill.size(); b++) {
+			if (basinDepth[b] >= lakeMinDepth) lakeStats.lakes++;
+		}
+
+		for (int i = 0; i < width * height; i++) {
+			if (basin[i] != 0 && basinDepth[basin[i]] >= lakeMinDepth) {
+				levels[i] = basinSpill[basin[i]];
+				lakeStats.lakeCells++;
+				lakeStats.maxLevel = max(lakeStats.maxLevel, levels[i]);
+			}
+		}
+
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				int i = y * width + x;
+				if (basin[i] != 0 && basinDepth[basin[i]] >= lakeMinDepth) continue;
+				float shore = 0.0f;
+				for (int dy = -1; dy <= 1; dy++) {
+					for (int dx = -1; dx <= 1; dx++) {
+						int nx = x + dx, ny = y + dy;
+						if (nx < 0 || nx >= width || ny < 0 || ny >= height) continue;
+						int n = ny * width + nx;
+						if (basin[n] != 0 && basinDepth[basin[n]] >= lakeMinDepth) shore = max(shore, basinSpill[basin[n]]);
+					}
+				}
+				if (shore <= image[i].x) levels[i] = shore;
+			}
+		}
+	}
+};
@@ -6,6 +6,7 @@
 
 struct RenderState {
 	TerrainTexture* terrainTexture;
+	float terrainScale;			// side of the terrain in world units
 	float waterLevel;
 	float waveLength;
 	float waveAmplitude;
@@ -0,0 +1,290 @@
+#pragma once
+#include "framework.h"
+#include "geometry.h"
+#include "asyncgeometry.h"
+#include "terraintexture.h"
+#include "renderstate.h"
+#include "meshexport.h"
+#include <future>
+
+bool terrainAdaptive = false;
+float adaptiveMaxError = 0.25;		// largest vertical distance of the mesh from the heightmap, world units
+
+// Adaptive mesh of the last build
+struct AdaptiveStats {
+	int vertices = 0;
+	int triangles = 0;
+	double errorMs = 0;			// error hierarchy of the heightmap, on the worker thread
+	double extractMs = 0;		// mesh for the current error, on the worker thread
+};
+
+AdaptiveStats adaptiveStats;
+
+// Right triangulated irregular network over a (2^k + 1)^2 height grid (Evans et al., the layout of
+// Mapbox Martini). Every triangle is split at the midpoint of its hypotenuse into two children, and
+// the error stored at a midpoint is the largest height error of splitting there or anywhere below, so
+// taking a split whenever that error is above the limit never leaves a T-junction. Triangles are
+// numbered like a heap starting at 2 for the two halves of the grid, the bits of the number pick the
+// child at every level.
+class Rtin {
+	int gridSize = 0;
+	int numTriangles = 0, numParentTriangles = 0;
+	std::vector<unsigned short> coords;		// corners a and b of every triangle, c follows from them
+	std::vector<float> errors;				// per grid point
+	std::vector<unsigned int> vertexIndex;	// per grid point, 0 when unused, otherwise index + 1
+	float maxError = 0;
+
+	template <typename F>
+	void traverse(int ax, int ay, int bx, int by, int cx, int cy, const F& leaf) {
+		int mx = (ax + bx) >> 1, my = (ay + by) >> 1;
+		if (abs(ax - cx) + abs(ay - cy) > 1 && errors[my * gridSize + mx] > maxError) {
+			traverse(cx, cy, ax, ay, mx, my, leaf);
+			traverse(bx, by, cx, cy, mx, my, leaf);
+		} else {
+			leaf(ax, ay, bx, by, cx, cy);
+		}
+	}
+
+public:
+	int getGridSize() { return gridSize; }
+
+	// Error hierarchy of heights given on the grid, row by row, children before their parents
+	void build(const std::vector<float>& heights, int size) {
+		if (size != gridSize) {
+			gridSize = size;
+			int tileSize = size - 1;
+			numTriangles = tileSize * tileSize * 2 - 2;
+			numParentTriangles = numTriangles - tileSize * tileSize;
+			coords.resize(numTriangles * 4);
+			for (int i = 0; i < numTriangles; i++) {
+				int id = i + 2;
+				int ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+				if (id & 1) bx = by = cx = tileSize;
+				else ax = ay = cy = tileSize;
+				while ((id >>= 1) > 1) {
+					int mx = (ax + bx) >> 1, my = (ay + by) >> 1;
+					if (id & 1) {
+						bx = ax; by = ay;
+						ax = cx; ay = cy;
+					} else {
+						ax = bx; ay = by;
+						bx = cx; by = cy;
+					}
+					cx = mx; cy = my;
+				}
+				coords[i * 4] = ax; coords[i * 4 + 1] = ay;
+				coords[i * 4 + 2] = bx; coords[i * 4 + 3] = by;
+			}
+		}
+
+		errors.assign(size * size, 0.0f);
+		for (int i = numTriangles - 1; i >= 0; i--) {
+			int ax = coords[i * 4], ay = coords[i * 4 + 1], bx = coords[i * 4 + 2], by = coords[i * 4 + 3];
+			int mx = (ax + bx) >> 1, my = (ay + by) >> 1;
+			int cx = mx + my - ay, cy = my + ax - mx;
+			int middle = my * size + mx;
+			float interpolated = 0.5f * (heights[ay * size + ax] + heights[by * size + bx]);
+			errors[middle] = max(errors[middle], fabsf(interpolated - heights[middle]));
+			if (i < numParentTriangles) {
+				int left = ((ay + cy) >> 1) * size + ((ax + cx) >> 1);
+				int right = ((by + cy) >> 1) * size + ((bx + cx) >> 1);
+				errors[middle] = max(errors[middle], max(errors[left], errors[right]));
+			}
+		}
+	}
+
+	// Grid points and triangles of the mesh within _maxError, triangles a, b, c in the orientation of
+	// the two root triangles
+	void extract(float _maxError, std::vector<int>& points, std::vector<unsigned int>& triangles) {
+		maxError = _maxError;
+		vertexIndex.assign(gridSize * gridSize, 0);
+		points.clear();
+		triangles.clear();
+		auto leaf = [&](int ax, int ay, int bx, int by, int cx, int cy) {
+			for (int corner : { ay * gridSize + ax, by * gridSize + bx, cy * gridSize + cx }) {
+				if (vertexIndex[corner] == 0) {
+					points.push_back(corner);
+					vertexIndex[corner] = (unsigned int)points.size();
+				}
+				triangles.push_back(vertexIndex[corner] - 1);
+			}
+		};
+		int last = gridSize - 1;
+		traverse(0, 0, last, last, last, 0, leaf);
+		traverse(last, last, 0, 0, 0, last, leaf);
+	}
+};
+
+// Terrain drawn as an RTIN mesh of the final heightmap instead of the uniform plane. The grid points
+// carry their texture coordinate and the terrain shader lifts them like the plane vertices, so with a
+// zero error the mesh covers the same surface. The heights are sampled at the vertices of a
+// (2^k + 1)^2 grid over the texture the way the plane samples them.
+//
+// Meshes are built on a worker thread from a copy of the heightmap, the render thread only starts the
+// builds and uploads the results a slice per frame. Until the first mesh is on the GPU, ready() is false.
+class RtinTerrain : public AsyncGeometry {
+	// Output of a build, everything the render thread needs afterwards
+	struct MeshBuild {
+		int gridSize = 0;
+		std::vector<int> points;
+		std::vector<float> pointHeights;		// world units
+		std::vector<unsigned int> triangles;
+		std::vector<VertexData> vertices;		// moved into the upload
+		std::vector<unsigned int> indices;
+		double errorMs = 0, extractMs = 0;
+		float traversalAcmr = 0, acmr = 0;		// vertex cache miss ratio before and after the ordering
+		double orderMs = 0;
+	};
+
+	float scale;
+	TerrainTexture* texture = nullptr;		// settings of the last build started
+	float amplitude = 0;
+	float meshError = -1;
+	std::future<MeshBuild> job;
+	MeshBuild mesh;							// last build finished
+
+	// Only used by the build in progress
+	Rtin rtin;
+	std::vector<float> gridHeights;			// world units, per grid point
+
+	// Worker thread: the error hierarchy when the heights are new, then the mesh within maxError
+	MeshBuild buildMesh(const std::vector<vec4>& image, int width, int height, float meshAmplitude, bool newHeights, float maxError) {
+		MeshBuild build;
+		auto start = std::chrono::high_resolution_clock::now();
+		if (newHeights) {
+			int tileSize = 1;
+			while (tileSize < max(width, height)) tileSize *= 2;
+			int size = tileSize + 1;
+			gridHeights.resize(size * size);
+			parallelFor(0, size, [&](int y) {
+				for (int x = 0; x < size; x++) {
+					gridHeights[y * size + x] = TerrainTexture::sampleImage(image, width, height, (float)x / tileSize, (float)y / tileSize) * meshAmplitude;
+				}
+			});
+			rtin.build(gridHeights, size);
+		}
+		auto extractStart = std::chrono::high_resolution_clock::now();
+		build.errorMs = std::chrono::duration<double, std::milli>(extractStart - start).count();
+
+		rtin.extract(maxError, build.points, build.triangles);
+		build.gridSize = rtin.getGridSize();
+		if (geometryCacheOrder) {
+			// The traversal already keeps neighbouring triangles close, the optimization orders them for
+			// the vertex cache, and the points follow in the order of their first use
+			auto orderStart = std::chrono::high_resolution_clock::now();
+			build.traversalAcmr = vertexCacheAcmr(build.triangles, build.triangles.size() / 3);
+			optimizeVertexCache(build.triangles, (int)build.points.size());
+			remapVertices(build.points, optimizeVertexFetch(build.triangles, (int)build.points.size()));
+			build.acmr = vertexCacheAcmr(build.triangles, build.triangles.size() / 3);
+			build.orderMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - orderStart).count();
+		}
+		build.pointHeights.resize(build.points.size());
+		build.vertices.resize(build.points.size());
+		for (size_t i = 0; i < build.points.size(); i++) {
+			build.pointHeights[i] = gridHeights[build.points[i]];
+			build.vertices[i].tex = pointUV(build.gridSize, build.points[i]);
+			build.vertices[i].pos = vec3((build.vertices[i].tex.x - 0.5f) * scale, 0, (build.vertices[i].tex.y - 0.5f) * scale);
+		}
+		build.indices = build.triangles;
+		build.extractMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - extractStart).count();
+		return build;
+	}
+
+	// Render thread: copies the heightmap if it changed and hands the build to a worker
+	void startBuild(TerrainTexture* _texture) {
+		bool newHeights = _texture != texture || terrainAmplitude != amplitude;
+		std::vector<vec4> image;
+		if (newHeights) {
+			_texture->download();
+			image = _texture->getImage();
+		}
+		texture = _texture;
+		amplitude = terrainAmplitude;
+		meshError = adaptiveMaxError;
+		int width = texture->getWidth(), height = texture->getHeight();
+		job = std::async(std::launch::async, [this, image = std::move(image), width, height, newHeights, meshAmplitude = amplitude, maxError = meshError]() {
+			return buildMesh(image, width, height, meshAmplitude, newHeights, maxError);
+		});
+	}
+
+	static vec2 pointUV(int gridSize, int point) {
+		return vec2((float)(point % gridSize) / (gridSize - 1), (float)(point / gridSize) / (gridSize - 1));
+	}
+
+public:
+	RtinTerrain(float _scale) {
+		scale = _scale;
+	}
+
+	~RtinTerrain() {
+		if (job.valid()) job.wait();
+	}
+
+	bool ready() { return frontIndexCount() > 0; }
+
+	// Once per frame before drawing: takes a finished build, continues its upload, and starts a new
+	// build when the terrain or the error limit changed and no other one is running
+	void update(const RenderState& state) {
+		if (!terrainAdaptive) return;
+		if (job.valid() && job.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+			mesh = job.get();
+			adaptiveStats.vertices = (int)mesh.points.size();
+			adaptiveStats.triangles = (int)mesh.triangles.size() / 3;
+			adaptiveStats.errorMs = mesh.errorMs;
+			adaptiveStats.extractMs = mesh.extractMs;
+			vertexCacheStats.adaptiveTraversalAcmr = mesh.traversalAcmr;
+			vertexCacheStats.adaptiveAcmr = mesh.acmr;
+			vertexCacheStats.adaptiveOptimizeMs = mesh.orderMs;
+			beginUpload(std::move(mesh.vertices), std::move(mesh.indices));
+		}
+		continueUpload();
+		if (!job.valid() && (state.terrainTexture != texture || terrainAmplitude != amplitude || adaptiveMaxError != meshError)) {
+			startBuild(state.terrainTexture);
+		}
+	}
+
+	// Triangle count and extraction time for a range of error limits, printed as a table. It replaces
+	// the error hierarchy of the builds, so the next update starts over from the heightmap.
+	void benchmark(TerrainTexture* benchmarkTexture) {
+		if (job.valid()) job.wait();
+		benchmarkTexture->download();
+		const std::vector<vec4>& image = benchmarkTexture->getImage();
+		bool newHeights = true;
+		printf("%10s %10s %10s %10s %10s %10s %10s %10s\n", "max error", "vertices", "triangles", "errors ms", "mesh ms", "ACMR", "ordered", "order ms");
+		for (float maxError : { 0.0f, 0.01f, 0.05f, 0.1f, 0.25f, 0.5f, 1.0f, 2.0f, 4.0f }) {
+			MeshBuild build = buildMesh(image, benchmarkTexture->getWidth(), benchmarkTexture->getHeight(), terrainAmplitude, newHeights, maxError);
+			printf("%10.2f %10d %10d %10.2f %10.2f %10.3f %10.3f %10.2f\n", maxError, (int)build.points.size(), (int)build.triangles.size() / 3, build.errorMs,
+				build.extractMs, build.traversalAcmr, build.acmr, build.orderMs);
+			newHeights = false;
+		}
+		texture = nullptr;
+		meshError = -1;
+	}
+
+	// Writes the last mesh built with world space heights, .obj or .gltf by the extension of the path
+	bool exportMesh(const char* path) {
+		if (mesh.points.empty()) return false;
+		std::vector<vec3> positions(mesh.points.size());
+		std::vector<vec2> uvs(mesh.points.size());
+		for (size_t i = 0; i < mesh.points.size(); i++) {
+			uvs[i] = pointUV(mesh.gridSize, mesh.points[i]);
+			positions[i] = vec3((uvs[i].x - 0.5f) * scale, mesh.pointHeights[i], (uvs[i].y - 0.5f) * scale);
+		}
+		bool done;
+		if (strstr(path, ".obj") != nullptr) done = exportObj(path, positions, uvs, mesh.triangles);
+		else done = exportGltf(path, positions, uvs, mesh.triangles);
+		if (done) printf("exported %d triangles to %s\n", (int)mesh.triangles.size() / 3, path);
+		return done;
+	}
+
+	void Draw(Shader& shader) {
+		auto start = std::chrono::high_resolution_clock::now();
+		setProgramUniform(shader, "vertexPulling", 0);
+		setProgramUniform(shader, "lodPatch", 0);
+		setProgramUniform(shader, "vertexGrid", 0);
+		drawFront();
+		geometryStats.drawCalls++;
+		geometryStats.triangles += frontIndexCount() / 3;
+		geometryStats.drawMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+};
@@ -10,7 +10,18 @@
 #include "terraintexture.h"
 #include "terrainshader.h"
 #include "plane.h"
+#include "geometrybenchmark.h"
+#include "cdlod.h"
+#include "flythrough.h"
+#include "patchgrid.h"
+#include "tessterrainshader.h"
+#include "clipmap.h"
+#include "clipmapshader.h"
+#include "rtin.h"
 #include "watershader.h"
+#include "watergrid.h"
+#include "planet.h"
+#include "planetshader.h"
 #include <iostream>
 
 const int gui_width = 300;
@@ -29,6 +40,23 @@ class Scene {
 	RenderState state;
 	std::vector<Object*> objects;
 	std::vector<Light> lights;
+	CdlodTerrain* terrainGeometry;
+	Object* terrainObject;
+	Object* tessTerrainObject;
+	Clipmap* clipmapGeometry;
+	Object* clipmapObject;
+	RtinTerrain* adaptiveGeometry;
+	Object* adaptiveObject;
+	WaterGrid* waterGeometry;
+	Object* waterObject;
+	bool waterCompareRequested = false;
+	Planet* planet;
+	Object* planetObject;
+	PlanetDescent planetDescent;
+	PrimitiveCounter primitiveCounter;
+	Flythrough flythrough;
+	UniformBuffer<FrameUniforms> frameBuffer;
+	UniformBuffer<LightUniforms> lightBuffer;
 
 	void getFPS(int& fps) {
 		float currentTime = glfwGetTime();
@@ -40,6 +68,44 @@ class Scene {
 		}
 	}
 
+	// Draws the water from its tiles and over the terrain geometry into occlusion queries, after the
+	// terrain and without writing anything. The depth test is off for the fragments rasterized and on for
+	// those that pass it, which should be the same for both.
+	void compareWater() {
+		waterCompareRequested = false;
+		bool tiles = waterTiles;
+		waterTiles = true;
+		waterGeometry->select(state);
+		unsigned int query;
+		glGenQueries(1, &query);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDepthMask(GL_FALSE);
+		auto samples = [&](bool useTiles, bool depthTest) {
+			waterTiles = useTiles;
+			if (depthTest) glEnable(GL_DEPTH_TEST);
+			else glDisable(GL_DEPTH_TEST);
+			glBeginQuery(GL_SAMPLES_PASSED, query);
+			waterObject->Draw(state);
+			glEndQuery(GL_SAMPLES_PASSED);
+			GLint64 count = 0;
+			glGetQueryObjecti64v(query, GL_QUERY_RESULT, &count);
+			return (long long)count;
+		};
+		waterStats.rasterizedTiles = samples(true, false);
+		waterStats.passedTiles = samples(true, true);
+		long long tileVertices = waterStats.vertices;
+		waterStats.rasterizedPlane = samples(false, false);
+		waterStats.passedPlane = samples(false, true);
+		glEnable(GL_DEPTH_TEST);
+		glDepthMask(GL_TRUE);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDeleteQueries(1, &query);
+		waterTiles = tiles;
+		waterStats.vertices = tileVertices;
+		printf("water: %lld / %lld vertices, %lld / %lld fragments rasterized, %lld / %lld passed the depth test (tiles / terrain grid)\n",
+			tileVertices, waterStats.planeVertices, waterStats.rasterizedTiles, waterStats.rasterizedPlane, waterStats.passedTiles, waterStats.passedPlane);
+	}
+
 	void updateState(RenderState& state) {
 		state.lights = lights;
 		state.time = getTime();
@@ -50,13 +116,75 @@ class Scene {
 						0, 0, 0, 1);
 		state.V = camera.V();
 		state.P = camera.P();
+		updateUniformBlocks(state);
+	}
+
+	// The blocks every draw of the frame shares, uploaded only if something changed
+	void updateUniformBlocks(const RenderState& state) {
+		uniformStats.newFrame();
+		FrameUniforms frame;
+		frame.wEye = state.wEye;
+		frame.time = state.time;
+		frame.fogColor = state.fogColor;
+		frame.terrainAmplitude = terrainAmplitude;
+		frame.waterLevel = state.waterLevel;
+		frame.waveLength = state.waveLength;
+		frame.waveAmplitude = state.waveAmplitude;
+		frame.waterAlpha = state.waterAlpha;
+		frame.slopeScale = terrainAmplitude / state.terrainScale;
+		frame.riverThreshold = flowRiverThreshold;
+		frame.showRivers = flowRivers && state.terrainTexture->flowAccumulationTextureId != 0 ? 1 : 0;
+		frameBuffer.update(frame);
+		frameBuffer.bind(FRAME_BLOCK);
+
+		LightUniforms lightUniforms;
+		lightUniforms.nLights = min((int)state.lights.size(), MAX_LIGHTS);
+		for (int i = 0; i < lightUniforms.nLights; i++) {
+			lightUniforms.lights[i].La = state.lights[i].La;
+			lightUniforms.lights[i].Le = state.lights[i].Le;
+			lightUniforms.lights[i].wLightPos = state.lights[i].wLightPos;
+		}
+		lightBuffer.update(lightUniforms);
+		lightBuffer.bind(LIGHT_BLOCK);
+	}
+
+	// The planet replaces the terrain and the water. The camera stays at the origin and the planet
+	// takes over its moves, see Planet.
+	void renderPlanet() {
+		planetDescent.update(*planet, camera);
+		planet->moveEye(camera);
+		camera.setClipPlanes(planet->nearPlane(), planet->farPlane());
+		updateState(state);
+		geometryStats.newFrame();
+		planet->update(state, camera.getFov(), windowHeight);
+		planetObject->Draw(state);
+		drawGUI(windowWidth - gui_width, 0, gui_width, gui_height);
 	}
 
 public:
 	void Render() {
 		glViewport(0, 0, windowWidth, windowHeight);
+		if (planetMode) {
+			renderPlanet();
+			return;
+		}
+		flythrough.update(camera);
 		updateState(state);
-		for (Object* obj : objects) { obj->Draw(state); }
+		geometryStats.newFrame();
+		terrainGeometry->select(state, camera.getFov());
+		clipmapGeometry->update(state);
+		adaptiveGeometry->update(state);
+		waterGeometry->select(state);
+		// The terrain is always the first object, drawn through the tessellation stages, as a clipmap, as
+		// an adaptive mesh or as the grid, and the primitives the GPU generates for it are counted on their own
+		objects[0] = terrainTessellation ? tessTerrainObject : terrainClipmap ? clipmapObject : terrainAdaptive && adaptiveGeometry->ready() ? adaptiveObject : terrainObject;
+		primitiveCounter.begin();
+		objects[0]->Draw(state);
+		primitiveCounter.end();
+		geometryStats.primitives = primitiveCounter.primitives;
+		geometryStats.vertexInvocations = primitiveCounter.vertexInvocations;
+		if (waterCompareRequested) compareWater();
+		for (size_t i = 1; i < objects.size(); i++) objects[i]->Draw(state);
 		drawGUI(windowWidth - gui_width, 0, gui_width, gui_height);
 	}
 
@@ -72,28 +200,51 @@ public:
 		state.waterAlpha = 0.6;
 		state.fogDensity = 0.1;
 		state.fogColor = vec3(0.7f, 0.9f, 1.0f);
+		state.terrainScale = scale;
 		state.terrainTexture = new TerrainTexture();
 
 		// Shaders
 		Shader* terrainShader	= new TerrainShader();
 		Shader* waterShader		= new WaterShader();
+		Shader* tessTerrainShader	= new TessTerrainShader();
+		Shader* clipmapShader	= new ClipmapShader();
+		Shader* planetShader	= new PlanetShader();
 
 		// Materials
 		Material* terrainMaterial	= new Material(vec3(0.8f, 0.8f, 0.8f), vec3(0.2f, 0.2f, 0.2f), vec3(0.4f, 0.4f, 0.4f), 0.2f);
 		Material* waterMaterial		= new Material(vec3(0.5f, 0.5f, 0.5f), vec3(0.4f, 0.4f, 0.4f), vec3(0.4f, 0.4f, 0.4f), 1.0f);
+		Material* planetMaterial	= new Material(vec3(1.0f, 1.0f, 1.0f), vec3(0.0f, 0.0f, 0.0f), vec3(0.4f, 0.4f, 0.4f), 1.0f);
 
 		// Geometries
-		Geometry* planeGeometry	= new Plane(tesselation, scale);
+		Plane* planeGeometry	= new Plane(tesselation, scale);
+		terrainGeometry			= new CdlodTerrain(planeGeometry, scale);
+		Geometry* patchGeometry	= new PatchGrid(TESS_PATCH_GRID, scale);
+		clipmapGeometry			= new Clipmap(scale);
+		adaptiveGeometry		= new RtinTerrain(scale);
+		waterGeometry			= new WaterGrid(terrainGeometry, scale, tesselation);
+		planet					= new Planet(terrainSeed);
 
 		// Objects
-		Object* terrainObject = new Object(terrainShader, terrainMaterial, planeGeometry);
+		terrainObject = new Object(terrainShader, terrainMaterial, terrainGeometry);
 		terrainObject->pos = vec3(0, 0, 0);
 		objects.push_back(terrainObject);
 
-		Object* waterObject = new Object(waterShader, waterMaterial, planeGeometry);
+		tessTerrainObject = new Object(tessTerrainShader, terrainMaterial, patchGeometry);
+		tessTerrainObject->pos = vec3(0, 0, 0);
+
+		clipmapObject = new Object(clipmapShader, terrainMaterial, clipmapGeometry);
+		clipmapObject->pos = vec3(0, 0, 0);
+
+		adaptiveObject = new Object(terrainShader, terrainMaterial, adaptiveGeometry);
+		adaptiveObject->pos = vec3(0, 0, 0);
+
+		waterObject = new Object(waterShader, waterMaterial, waterGeometry);
 		waterObject->pos = vec3(0, 0, 0);
 		objects.push_back(waterObject);
 
+		planetObject = new Object(planetShader, planetMaterial, planet);
+		planetObject->pos = vec3(0, 0, 0);
+
 		// Lights
 		lights.resize(1);
 		lights[0].wLightPos = vec4(0, 50, 0, 1);
@@ -111,6 +262,86 @@ public:
 		// Display FPS
 		getFPS(fps);
 		ImGui::Text("FPS: %d", fps);
+		ImGui::Checkbox("single draw", &geometrySingleDraw);
+		ImGui::SameLine();
+		ImGui::Checkbox("vertex pulling", &gridVertexPulling);
+		if (gridVertexPulling) ImGui::SliderInt("grid tess", &gridTesselation, 16, 2048, "%d", ImGuiSliderFlags_Logarithmic);
+		ImGui::Text("draw calls: %d, submit %.3f ms", geometryStats.drawCalls, geometryStats.drawMs);
+		ImGui::Text("binds: %d, bind + draw %.3f ms, blocks %d uploaded %d kept", uniformStats.binds, uniformStats.drawMs, uniformStats.uploads, uniformStats.skipped);
+		ImGui::Text("vertices %.0f KB + indices %.0f KB", geometryStats.vertexBytes / 1024.0, geometryStats.indexBytes / 1024.0);
+		ImGui::Text("(strip vertices were %.0f KB)", geometryStats.stripVertexBytes / 1024.0);
+		ImGui::Text("triangles: %lld, terrain primitives: %lld", geometryStats.triangles, geometryStats.primitives);
+		ImGui::Checkbox("cache order", &geometryCacheOrder);
+		ImGui::SameLine();
+		ImGui::Text("%lld terrain vertex shader runs", geometryStats.vertexInvocations);
+		ImGui::Text("grid ACMR %.3f strips, %.3f Morton, %.3f ordered", vertexCacheStats.gridStripAcmr, vertexCacheStats.gridMortonAcmr, vertexCacheStats.gridAcmr);
+		ImGui::Checkbox("tessellation", &terrainTessellation);
+		if (terrainTessellation) {
+			ImGui::SameLine();
+			ImGui::SliderFloat("px/edge", &tessPixelsPerEdge, 1.0, 64.0, "%.1f", ImGuiSliderFlags_Logarithmic);
+			ImGui::Text("patches %.1f KB", (geometryStats.patchVertexBytes + geometryStats.patchIndexBytes) / 1024.0);
+		}
+		ImGui::Checkbox("LOD", &terrainLod);
+		if (terrainLod) {
+			ImGui::SameLine();
+			ImGui::SliderFloat("pixel error", &lodPixelError, 0.25, 16.0, "%.2f", ImGuiSliderFlags_Logarithmic);
+			ImGui::Text("%d levels, %d patches, select %.3f ms", lodStats.levels, lodStats.nodes, lodStats.selectMs);
+			ImGui::Checkbox("culling", &terrainCulling);
+			ImGui::SameLine();
+			ImGui::Text("%d visible, %d culled", cullStats.visible, cullStats.culled);
+			ImGui::Text("select + cull %.3f ms, %d box tests", cullStats.cullMs, cullStats.boxTests);
+			if (ImGui::Button("Benchmark culling")) terrainGeometry->benchmarkCulling();
+			ImGui::SameLine();
+			ImGui::Text("%d: %.3f / %.3f ms", cullStats.benchmarkPatches, cullStats.benchmarkFlatMs, cullStats.benchmarkTreeMs);
+		}
+		ImGui::Checkbox("clipmap", &terrainClipmap);
+		if (terrainClipmap) {
+			ImGui::SameLine();
+			ImGui::SliderInt("levels", &clipmapLevels, 1, CLIPMAP_MAX_LEVELS);
+			ImGui::Text("%lld texels in %d uploads, %.3f ms", clipmapStats.texelsUpdated, clipmapStats.uploads, clipmapStats.updateMs);
+		}
+		ImGui::Checkbox("adaptive mesh", &terrainAdaptive);
+		if (terrainAdaptive) {
+			ImGui::SameLine();
+			ImGui::SliderFloat("max error", &adaptiveMaxError, 0.0, 4.0, "%.2f", ImGuiSliderFlags_Logarithmic);
+			ImGui::Text("%d triangles, %d vertices", adaptiveStats.triangles, adaptiveStats.vertices);
+			ImGui::Text("errors %.2f ms, mesh %.2f ms in the background", adaptiveStats.errorMs, adaptiveStats.extractMs);
+			ImGui::Text("ACMR %.3f, ordered %.3f in %.2f ms", vertexCacheStats.adaptiveTraversalAcmr, vertexCacheStats.adaptiveAcmr, vertexCacheStats.adaptiveOptimizeMs);
+			ImGui::SliderInt("upload KB", &meshUploadSliceKB, 16, 4096, "%d", ImGuiSliderFlags_Logarithmic);
+			ImGui::Text("upload in %d frames, slice max %.3f ms", meshUploadStats.frames, meshUploadStats.maxSliceMs);
+			if (ImGui::Button("Export OBJ")) adaptiveGeometry->exportMesh("terrain.obj");
+			ImGui::SameLine();
+			if (ImGui::Button("Export glTF")) adaptiveGeometry->exportMesh("terrain.gltf");
+			ImGui::SameLine();
+			if (ImGui::Button("Benchmark errors")) adaptiveGeometry->benchmark(state.terrainTexture);
+		}
+		if (ImGui::Checkbox("planet", &planetMode)) {
+			if (planetMode) planet->enter(camera);
+			else planet->leave(camera);
+		}
+		if (planetMode) {
+			ImGui::SameLine();
+			ImGui::SliderFloat("px error", &planetPixelError, 1.0, 32.0, "%.1f", ImGuiSliderFlags_Logarithmic);
+			ImGui::Text("altitude %.0f m, %d chunks, level %d", planetStats.altitude, planetStats.drawn, planetStats.deepestLevel);
+			ImGui::Checkbox("frustum", &planetFrustumCulling);
+			ImGui::SameLine();
+			ImGui::Checkbox("horizon", &planetHorizonCulling);
+			ImGui::Text("culled %d by frustum, %d by horizon", planetStats.culledFrustum, planetStats.culledHorizon);
+			ImGui::SliderInt("workers", &planetWorkers, 1, 16);
+			ImGui::SliderInt("uploads/frame", &planetUploadsPerFrame, 1, 64);
+			ImGui::Text("%d building, %d waiting, %d cached", planetStats.building, planetStats.waiting, planetStats.cached);
+			ImGui::Text("build %.2f ms, update %.3f ms", planetStats.buildMs, planetStats.updateMs);
+			if (ImGui::Button("Descend") && !planetDescent.active()) planetDescent.start(*planet);
+			ImGui::SameLine();
+			ImGui::Text("%.2f ms (p99 %.2f, max %.2f)", planetDescentStats.averageMs, planetDescentStats.p99Ms, planetDescentStats.maxMs);
+		}
+		if (ImGui::Button("Flythrough") && !flythrough.active()) flythrough.start(camera);
+		ImGui::SameLine();
+		ImGui::Text("%.2f ms (max %.2f), %.0f prims", flythroughStats.averageMs, flythroughStats.maxMs, flythroughStats.averagePrimitives);
+		ImGui::Checkbox("parallel fill", &geometryParallelFill);
+		ImGui::SameLine();
+		if (ImGui::Button("Benchmark geometry")) benchmarkGeometry();
+		if (ImGui::Button("Benchmark vertex format")) benchmarkVertexFormat(terrainObject, state);
 		ImGui::SliderInt("texture dim", &terrainTextureWidth, 0, 256);
 		ImGui::SliderInt("texture dim", &terrainTextureHeight, 0, 256);
 
@@ -134,6 +365,15 @@ public:
 		ImGui::SliderFloat("wavelength", &state.waveLength, 0.0, 25.0, "%.1f");
 		ImGui::SliderFloat("wave ampl", &state.waveAmplitude, 0.0, 1.0, "%.2f");
 		ImGui::SliderFloat("water alpha", &state.waterAlpha, 0.0, 1.0, "%.2f");
+		ImGui::Checkbox("water tiles", &waterTiles);
+		if (waterTiles) {
+			ImGui::SameLine();
+			ImGui::SliderInt("quads/wave", &waterQuadsPerWave, 1, 32);
+			ImGui::Text("%d of %d tiles, %lld vertices (grid %lld)", waterStats.visible, waterStats.tiles, waterStats.vertices, waterStats.planeVertices);
+		}
+		if (ImGui::Button("Compare water")) waterCompareRequested = true;
+		ImGui::SameLine();
+		ImGui::Text("%lld / %lld fragments", waterStats.rasterizedTiles, waterStats.rasterizedPlane);
 
 		ImGui::NewLine();
 		ImGui::Separator();
@@ -141,12 +381,76 @@ public:
 
 		// Erosion sliders
 		ImGui::Checkbox("erosion", &terrainErosion);
-		ImGui::SliderInt("iterations", &erosionIterations, 1, 20);
-		ImGui::SliderFloat("min volume", &erosionMinVolume, 0.0, 1.0, "%.1f");
-		ImGui::SliderFloat("density", &erosionDensity, 0.0, 2.0, "%.1f");
-		ImGui::SliderFloat("evap rate", &erosionEvaporationRate, 0.001, 0.1, "%.3f");
-		ImGui::SliderFloat("depos rate", &erosionDepositionRate, 0.0, 1.0, "%.2f");
-		ImGui::SliderFloat("friction", &erosionFriction, 0.0, 0.5, "%.2f");
+		ImGui::Combo("mode", &erosionMode, "droplets (GPU)\0pipes (GPU)\0pipes (CPU)\0");
+		if (erosionMode == EROSION_DROPLETS_GPU) {
+			ImGui::SliderInt("iterations", &erosionIterations, 1, 20);
+			ImGui::SliderInt("droplets", &erosionDroplets, 1024, 1 << 22, "%d", ImGuiSliderFlags_Logarithmic);
+			ImGui::SliderInt("max lifetime", &erosionMaxLifetime, 16, 4096, "%d", ImGuiSliderFlags_Logarithmic);
+			ImGui::SliderFloat("budget ms", &erosionDispatchBudget, 1.0, 100.0, "%.0f");
+			ImGui::Checkbox("stop on convergence", &erosionConvergence);
+			if (erosionConvergence) ImGui::SliderFloat("min change", &erosionConvergenceThreshold, 0.01, 1.0, "%.2f");
+			ImGui::Checkbox("tiled", &erosionTiled);
+			if (erosionTiled) {
+				ImGui::SliderInt("tile size", &erosionTileSize, 32, 1024, "%d", ImGuiSliderFlags_Logarithmic);
+				ImGui::SliderInt("halo", &erosionTileHalo, 0, erosionTileSize / 2);
+				ImGui::SliderInt("tile batch", &erosionTileBatch, 1, 64);
+			} else {
+				ImGui::SliderInt("levels", &erosionLevels, 1, 6);
+				ImGui::SliderFloat("level droplets", &erosionLevelDropletScale, 0.05, 1.0, "%.2f");
+			}
+			ImGui::SliderFloat("min volume", &erosionMinVolume, 0.0, 1.0, "%.1f");
+			ImGui::SliderFloat("density", &erosionDensity, 0.0, 2.0, "%.1f");
+			ImGui::SliderFloat("evap rate", &erosionEvaporationRate, 0.001, 0.1, "%.3f");
+			ImGui::SliderFloat("depos rate", &erosionDepositionRate, 0.0, 1.0, "%.2f");
+			ImGui::SliderFloat("friction", &erosionFriction, 0.0, 0.5, "%.2f");
+		} else {
+			ImGui::SliderInt("steps", &pipeErosionSteps, 1, 2000);
+			ImGui::SliderFloat("time step", &pipeTimeStep, 0.001, 0.1, "%.3f");
+			ImGui::SliderFloat("rain rate", &pipeRainRate, 0.0, 1.0, "%.2f");
+			ImGui::SliderFloat("evap rate", &pipeEvaporationRate, 0.0, 1.0, "%.2f");
+			ImGui::SliderFloat("capacity", &pipeSedimentCapacity, 0.0, 2.0, "%.2f");
+			ImGui::SliderFloat("dissolve", &pipeDissolveRate, 0.0, 1.0, "%.2f");
+			ImGui::SliderFloat("deposit", &pipeDepositionRate, 0.0, 1.0, "%.2f");
+		}
+
+		// Erosion measurements of the last run
+		ImGui::Text("erosion: %.1f ms total, %.1f ms GPU", erosionStats.totalMs, erosionStats.gpuMs);
+		ImGui::Text("dispatches: %d (max %.1f ms), tiles: %d", erosionStats.dispatches, erosionStats.maxDispatchMs, erosionStats.tiles);
+		ImGui::Text("iterations: %d of %d, saved %.1f ms", erosionStats.iterationsRun, erosionStats.iterationsPlanned, erosionStats.savedMs);
+		if (!erosionStats.iterationChange.empty()) {
+			ImGui::PlotLines("change", erosionStats.iterationChange.data(), (int)erosionStats.iterationChange.size(), 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 40));
+		}
+		ImGui::Text("steps: %llu", erosionStats.dropletSteps);
+		ImGui::Text("evaporated: %llu, out of bounds: %llu", erosionStats.evaporated, erosionStats.outOfBounds);
+		ImGui::Text("expired: %llu", erosionStats.expired);
+		float histogram[EROSION_HISTOGRAM_BINS];
+		for (int i = 0; i < EROSION_HISTOGRAM_BINS; i++) histogram[i] = (float)erosionStats.lifetimeHistogram[i];
+		ImGui::PlotHistogram("lifetime", histogram, EROSION_HISTOGRAM_BINS, 0, nullptr, 0.0f, FLT_MAX, ImVec2(0, 40));
+		if (ImGui::Button("Export stats")) erosionStats.exportCSV("erosion_stats.csv");
+
+		// Thermal erosion sliders
+		ImGui::Checkbox("thermal", &thermalErosion);
+		ImGui::SameLine();
+		ImGui::Checkbox("on GPU", &thermalErosionOnGPU);
+		ImGui::Combo("order", &thermalErosionOrder, "before hydraulic\0after hydraulic\0");
+		ImGui::SliderInt("thermal iters", &thermalIterations, 1, 500);
+		ImGui::SliderFloat("talus angle", &thermalTalusAngle, 0.0, 89.0, "%.1f");
+		ImGui::SliderFloat("thermal rate", &thermalRate, 0.0, 1.0, "%.2f");
+
+		// Flow routing
+		ImGui::Checkbox("flow routing", &flowRouting);
+		ImGui::SameLine();
+		ImGui::Checkbox("rivers", &flowRivers);
+		ImGui::SliderFloat("river area", &flowRiverThreshold, 10.0, 100000.0, "%.0f", ImGuiSliderFlags_Logarithmic);
+		ImGui::Text("flow: dir %.1f, deps %.1f, acc %.1f, upload %.1f ms", flowStats.directionMs, flowStats.dependencyMs, flowStats.accumulationMs, flowStats.uploadMs);
+		ImGui::Text("largest basin: %.0f cells", flowStats.maxAccumulation);
+
+		// Lakes
+		ImGui::Checkbox("lakes", &lakes);
+		ImGui::SliderFloat("lake depth", &lakeMinDepth, 0.0, 0.05, "%.3f");
+		ImGui::Text("lakes: %d of %d basins, %d cells", lakeStats.lakes, lakeStats.basins, lakeStats.lakeCells);
+		ImGui::Text("fill %.1f ms, upload %.1f ms", lakeStats.fillMs, lakeStats.uploadMs);
+		ImGui::Text("normals: sobel %.1f ms, upload %.1f ms", normalStats.sobelMs, normalStats.uploadMs);
 
 		ImGui::NewLine();
 		ImGui::Separator();
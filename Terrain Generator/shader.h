@@ -1,18 +1,32 @@
 #pragma once
 #include "framework.h"
+#include "uniformblocks.h"
 
 
 class Shader {
 	unsigned int shaderProgramId = 0;
 	unsigned int vertexShader = 0, geometryShader = 0, fragmentShader = 0;
+	unsigned int tessControlShader = 0, tessEvaluationShader = 0;
+	std::vector<std::pair<std::string, int>> locations;	// uniform names already looked up in this program
 
+protected:
 	// get the address of a GPU uniform variable
 	int getLocation(const std::string& name) {
-		int location = glGetUniformLocation(shaderProgramId, name.c_str());
+		int location = uniformLocation(name.c_str());
 		if (location < 0) printf("uniform %s cannot be set\n", name.c_str());
 		return location;
 	}
 
+	// compile a stage, with the uniform blocks in place of their include line
+	void compile(unsigned int shader, const char* const source) {
+		std::string expanded(source);
+		size_t at = expanded.find(UNIFORM_BLOCKS_INCLUDE);
+		if (at != std::string::npos) expanded.replace(at, strlen(UNIFORM_BLOCKS_INCLUDE), uniformBlocksSource);
+		const char* text = expanded.c_str();
+		glShaderSource(shader, 1, &text, NULL);
+		glCompileShader(shader);
+	}
+
 public:
 	Shader() { shaderProgramId = 0; }
 
@@ -20,31 +34,50 @@ public:
 
 	unsigned int getId() { return shaderProgramId; }
 
+	// Address of a uniform, asked from GL only the first time a name is used, -1 if the program has none
+	int uniformLocation(const char* name) {
+		for (const auto& entry : locations) if (entry.first == name) return entry.second;
+		int location = glGetUniformLocation(shaderProgramId, name);
+		locations.push_back({ name, location });
+		return location;
+	}
+
 	bool create(const char* const vertexShaderSource,
 		const char* const fragmentShaderSource, const char* const fragmentShaderOutputName,
-		const char* const geometryShaderSource = nullptr)
+		const char* const geometryShaderSource = nullptr,
+		const char* const tessControlShaderSource = nullptr, const char* const tessEvaluationShaderSource = nullptr)
 	{
 		// Create vertex shader from string
 		if (vertexShader == 0) vertexShader = glCreateShader(GL_VERTEX_SHADER);
-		glShaderSource(vertexShader, 1, (const GLchar**)&vertexShaderSource, NULL);
-		glCompileShader(vertexShader);
+		compile(vertexShader, vertexShaderSource);
 
 		// Create geometry shader from string if given
 		if (geometryShaderSource != nullptr) {
 			if (geometryShader == 0) geometryShader = glCreateShader(GL_GEOMETRY_SHADER);
-			glShaderSource(geometryShader, 1, (const GLchar**)&geometryShaderSource, NULL);
-			glCompileShader(geometryShader);
+			compile(geometryShader, geometryShaderSource);
+		}
+
+		// Create tessellation shaders from string if given, the evaluation stage alone uses default levels
+		if (tessControlShaderSource != nullptr) {
+			if (tessControlShader == 0) tessControlShader = glCreateShader(GL_TESS_CONTROL_SHADER);
+			compile(tessControlShader, tessControlShaderSource);
+		}
+		if (tessEvaluationShaderSource != nullptr) {
+			if (tessEvaluationShader == 0) tessEvaluationShader = glCreateShader(GL_TESS_EVALUATION_SHADER);
+			compile(tessEvaluationShader, tessEvaluationShaderSource);
 		}
 
 		// Create fragment shader from string
 		if (fragmentShader == 0) fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-		glShaderSource(fragmentShader, 1, (const GLchar**)&fragmentShaderSource, NULL);
-		glCompileShader(fragmentShader);
+		compile(fragmentShader, fragmentShaderSource);
 
 		shaderProgramId = glCreateProgram();
+		locations.clear();
 		glAttachShader(shaderProgramId, vertexShader);
 		glAttachShader(shaderProgramId, fragmentShader);
 		if (geometryShader > 0) glAttachShader(shaderProgramId, geometryShader);
+		if (tessControlShader > 0) glAttachShader(shaderProgramId, tessControlShader);
+		if (tessEvaluationShader > 0) glAttachShader(shaderProgramId, tessEvaluationShader);
 
 		// Connect the fragmentColor to the frame buffer memory
 		glBindFragDataLocation(shaderProgramId, 0, fragmentShaderOutputName);	// this output goes to the frame buffer memory
@@ -91,27 +124,5 @@ public:
 		if (location >= 0) glUniformMatrix4fv(location, 1, GL_TRUE, mat);
 	}
 
-	void setUniform(const TerrainTexture& texture, const std::string& samplerName, unsigned int textureUnit = 0) {
-		int location = getLocation(samplerName);
-		if (location >= 0) {
-			glUniform1i(location, textureUnit);
-			glActiveTexture(GL_TEXTURE0 + textureUnit);
-			glBindTexture(GL_TEXTURE_2D, texture.textureId);
-		}
-	}
-
-	void setUniformMaterial(const Material& material, const std::string& name) {
-		setUniform(material.kd, name + ".kd");
-		setUniform(material.ks, name + ".ks");
-		setUniform(material.ka, name + ".ka");
-		setUniform(material.shininess, name + ".shininess");
-	}
-
-	void setUniformLight(const Light& light, const std::string& name) {
-		setUniform(light.La, name + ".La");
-		setUniform(light.Le, name + ".Le");
-		setUniform(light.wLightPos, name + ".wLightPos");
-	}
-
 	~Shader() { if (shaderProgramId > 0) glDeleteProgram(shaderProgramId); }
 };
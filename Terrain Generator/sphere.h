@@ -1,12 +1,16 @@
 #pragma once
 #include "geometry.h"
 
-class Sphere : public Geometry {
+class Sphere : public SurfaceGeometry<Sphere> {
 public:
 	int tesselation = 100;
 	float scale = 1;
 
-	Sphere() { create(tesselation, tesselation); }
+	Sphere(int _tesselation = 100, float _scale = 1) {
+		tesselation = _tesselation;
+		scale = _scale;
+		create(tesselation, tesselation);
+	}
 
 	void eval(float u, float v, vec3& pos) {
 		float U = u * 2.0f * M_PI;
@@ -7,21 +7,22 @@
 #include "terraintexture.h"
 
 class TerrainShader : public Shader {
+protected:
 	const char* vertexSource = R"(
 		#version 450 core
 		precision highp float;
 
-		struct Light {
-			vec3 La, Le;
-			vec4 wLightPos;
-		};
-
-		uniform sampler2D terrainTexture;
-		uniform float terrainAmplitude;
-		uniform vec3  wEye;         // Eye position
-		uniform mat4  MVP, M;		// MVP, Model
-		uniform Light[8] lights;    // Light sources 
-		uniform int   nLights;
+		#include <uniformblocks>
+
+		layout(binding = 0) uniform sampler2D terrainTexture;
+		uniform int   vertexPulling;		// grid from gl_VertexID and gl_InstanceID instead of the vertex buffer
+		uniform int   gridTesselation;
+		uniform float gridScale;
+		uniform int   lodPatch;			// CDLOD patch from the grid point in [0, 1]
+		uniform vec3  patchRect;		// patch corner x, z and size
+		uniform vec2  morphRange;		// distance where morphing into the coarser level starts and ends
+		uniform int   patchGridDim;
+		uniform int   vertexGrid;		// vtxUV is a grid point of a grid this many quads wide, vtxPos unused
 		
 		layout(location = 0) in vec3  vtxPos;            // pos in modeling space
 		layout(location = 1) in vec2  vtxUV;
@@ -33,8 +34,27 @@ class TerrainShader : public Shader {
 		out float distance;			// Distance from camera
 
 		void main() {
+			vec2 gridUV = vtxUV;
 			vec3 vertexPos = vtxPos;
-			float terrainHeight = texture(terrainTexture, vtxUV).r;
+			if (vertexGrid != 0) {
+				gridUV = vtxUV / float(vertexGrid);
+				vertexPos = vec3((gridUV.x - 0.5) * gridScale, 0.0, (gridUV.y - 0.5) * gridScale);
+			}
+			vec2 uv = gridUV;
+			if (vertexPulling != 0) {
+				uv = vec2(gl_VertexID >> 1, gl_InstanceID + (gl_VertexID & 1)) / float(gridTesselation);
+				vertexPos = vec3((uv.x - 0.5) * gridScale, 0.0, (uv.y - 0.5) * gridScale);
+			}
+			else if (lodPatch != 0) {
+				vec2 world = patchRect.xy + gridUV * patchRect.z;
+				float h = texture(terrainTexture, world / gridScale + 0.5).r * terrainAmplitude;
+				float morph = clamp((length(vec3(world.x, h, world.y) - wEye) - morphRange.x) / (morphRange.y - morphRange.x), 0.0, 1.0);
+				vec2 local = gridUV - fract(gridUV * float(patchGridDim) * 0.5) * 2.0 / float(patchGridDim) * morph;
+				world = patchRect.xy + local * patchRect.z;
+				uv = world / gridScale + 0.5;
+				vertexPos = vec3(world.x, 0.0, world.y);
+			}
+			float terrainHeight = texture(terrainTexture, uv).r;
 			vertexPos.y = terrainHeight * terrainAmplitude;		
 			gl_Position = vec4(vertexPos, 1) * MVP; // to NDC
 			vec4 wPos = vec4(vertexPos, 1) * M;
@@ -42,7 +62,7 @@ class TerrainShader : public Shader {
 				wLight[i] = lights[i].wLightPos.xyz * wPos.w - wPos.xyz * lights[i].wLightPos.w;
 			}
 		    wView  = wEye * wPos.w - wPos.xyz;
-		    texcoord = vtxUV;
+		    texcoord = uv;
 			height = wPos.y;
 			distance = length(wPos.xyz - wEye);
 		}
@@ -52,19 +72,11 @@ class TerrainShader : public Shader {
 	#version 450 core
 	precision highp float;
 
-	struct Light {
-		vec3 La, Le;
-		vec4 wLightPos;
-	};
+	#include <uniformblocks>
 
-	struct Material {
-		vec3 kd, ks, ka;
-		float shininess;
-	};
-
-	uniform Material material;
-	uniform Light[8] lights;    // Light sources 
-	uniform int   nLights;
+	layout(binding = 1) uniform sampler2D flowAccumulation;
+	layout(binding = 3) uniform sampler2D terrainNormals;	// height gradient per texture coordinate
+	uniform int derivativeNormals;		// heights not from the map towards its border and beyond, see ClipmapShader
 
 	in  vec3 wView;         // interpolated world sp view
 	in  vec3 wLight[8];     // interpolated world sp illum dir
@@ -75,11 +87,22 @@ class TerrainShader : public Shader {
 	out vec4 fragmentColor; // output goes to frame buffer
 
 	vec3 texColor = vec3(0.1, 0.4, 0.1);
+	vec3 riverColor = vec3(0.15, 0.3, 0.6);
 
 	void main() {
-		vec3 xTangent = dFdx(wView);
-		vec3 yTangent = dFdy(wView);
-		vec3 N = normalize(cross(xTangent, yTangent));
+		if (showRivers != 0) {
+			float upstream = texture(flowAccumulation, texcoord).r;
+			texColor = mix(texColor, riverColor, smoothstep(log(riverThreshold), log(riverThreshold * 8.0), log(max(upstream, 1.0))));
+		}
+
+		vec2 gradient = texture(terrainNormals, texcoord).rg * slopeScale;
+		vec3 N = normalize(vec3(-gradient.x, 1.0, -gradient.y));
+		if (derivativeNormals != 0) {
+			// the normal of the triangle, faded in where the map fades out
+			vec3 facet = normalize(cross(dFdx(wView), dFdy(wView)));
+			float inside = clamp(min(min(texcoord.x, texcoord.y), min(1.0 - texcoord.x, 1.0 - texcoord.y)) * 16.0, 0.0, 1.0);
+			N = normalize(mix(facet, N, inside));
+		}
 		vec3 V = normalize(wView); 
 		
 		vec3 ka = material.ka * texColor;
@@ -100,23 +123,17 @@ class TerrainShader : public Shader {
 )";
 
 public:
-	TerrainShader() {
-		create(vertexSource, fragmentSource, "fragmentColor");
+	// Derived shaders with other stages build their own program around the fragment shader
+	TerrainShader(bool build = true) {
+		if (build) create(vertexSource, fragmentSource, "fragmentColor");
 	}
 
+	// Everything else is in the uniform blocks
 	void Bind(RenderState state) {
 		Use();
 
-		setUniform(*state.terrainTexture, std::string("terrainTexture"));
-		setUniform(terrainAmplitude, "terrainAmplitude");
-		setUniform(state.MVP, "MVP");
-		setUniform(state.M, "M");
-		setUniform(state.wEye, "wEye");
-		setUniformMaterial(*state.material, "material");
-
-		setUniform((int)state.lights.size(), "nLights");
-		for (unsigned int i = 0; i < state.lights.size(); i++) {
-			setUniformLight(state.lights[i], std::string("lights[") + std::to_string(i) + std::string("]"));
-		}
+		glBindTextureUnit(0, state.terrainTexture->textureId);
+		glBindTextureUnit(1, state.terrainTexture->flowAccumulationTextureId);
+		glBindTextureUnit(3, state.terrainTexture->normalTextureId);
 	}
 };
\ No newline at end of file
@@ -1,39 +1,32 @@
 #pragma once
 #include "FastNoiseLite.h"
 #include "erosioncomputeshader.h"
+#include "pipeerosioncomputeshader.h"
+#include "pipeerosion.h"
+#include "thermalerosioncomputeshader.h"
+#include "thermalerosion.h"
+#include "multigridcomputeshader.h"
+#include "tilederosion.h"
+#include "flowrouting.h"
+#include "priorityflood.h"
+#include "normalmap.h"
 #include "renderstate.h"
 
 class TerrainTexture {
 	std::vector<vec4> image;
+	std::vector<float> lakeLevels;		// normalized lake surface per texel or 0, empty without lakes
 	int width, height;
 	float frequency;
 	int octaves;
 	int seed;
 	FastNoiseLite noise;
 
-	float getHeightNormalized(float U, float V) {
-		float height = 0;
-		float layerAmplitude = 1;
-		float layerFrequency = frequency;
-		float maxHeight = 0;
-
-		for (int i = 0; i < octaves; i++) {
-			maxHeight += layerAmplitude;
-			noise.SetFrequency(layerFrequency);
-			height += noise.GetNoise(U, V) * layerAmplitude;
-			layerAmplitude *= 0.5;
-			layerFrequency *= 2.0;
-		}
-
-		// Normalize height
-		float normalizedHeight = (height + maxHeight) / (2 * maxHeight);
-		if (normalizedHeight < 0.0) normalizedHeight = 0.0;
-		if (normalizedHeight > 1.0) normalizedHeight = 1.0;
-		return normalizedHeight;
-	}
-
 public:
 	unsigned int textureId = 0;
+	unsigned int flowDirectionTextureId = 0;		// R8UI, D8 direction index or FLOW_NONE
+	unsigned int flowAccumulationTextureId = 0;		// R32F, upstream area in cells
+	unsigned int lakeLevelTextureId = 0;			// R32F, normalized lake surface or 0
+	unsigned int normalTextureId = 0;				// RG16F, height gradient, see NormalMap
 
 	TerrainTexture() {
 		width = terrainTextureWidth;
@@ -43,6 +36,7 @@ public:
 		seed = terrainSeed;
 		noise.SetNoiseType(FastNoiseLite::NoiseType_OpenSimplex2);
 		noise.SetSeed(seed);
+		noise.SetFrequency(1);
 
 		image.resize(width * height);
 		for (int x = 0; x < width; x++) {
@@ -65,13 +59,226 @@ public:
 		glTextureSubImage2D(textureId, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, image.data());
 		glBindImageTexture(0, textureId, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
 
-		if(terrainErosion) erode();
-		
+		erode();
+		if (flowRouting) routeFlow();
+		if (lakes) fillDepressions();
+		computeNormals();
 	}
 
 	void erode() {
-		ErosionComputeShader* computeShader = new ErosionComputeShader();
-		computeShader->Bind();
+		erosionStats.reset();
+		erosionStats.mode = erosionMode;
+		erosionStats.width = width;
+		erosionStats.height = height;
+		erosionStats.droplets = erosionDroplets;
+		erosionStats.iterations = erosionIterations;
+		erosionStats.levels = erosionLevels;
+		auto start = std::chrono::high_resolution_clock::now();
+
+		if (thermalErosion && thermalErosionOrder == THERMAL_BEFORE_HYDRAULIC) erodeThermal();
+		if (terrainErosion) erodeHydraulic();
+		if (thermalErosion && thermalErosionOrder == THERMAL_AFTER_HYDRAULIC) erodeThermal();
+
+		glFinish();
+		erosionStats.totalMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	void erodeHydraulic() {
+		switch (erosionMode) {
+		case EROSION_DROPLETS_GPU: {
+			if (erosionTiled) {
+				TiledErosion tiled;
+				download();
+				ImageHeightStore store(image, width, height);
+				tiled.erode(store);
+				upload();
+				glBindImageTexture(0, textureId, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+			} else if (erosionLevels > 1) {
+				erodeMultigrid();
+			} else {
+				ErosionComputeShader computeShader;
+				computeShader.Bind();
+			}
+			break;
+		}
+		case EROSION_PIPES_GPU: {
+			PipeErosionComputeShader computeShader(width, height);
+			computeShader.Bind();
+			break;
+		}
+		case EROSION_PIPES_CPU: {
+			PipeErosion pipeErosion(width, height);
+			download();
+			pipeErosion.erode(image);
+			upload();
+			break;
+		}
+		}
+	}
+
+	// Erode a pyramid of downsampled maps from coarse to fine. Each level starts from its downsampled
+	// state plus the upsampled change of the coarser level, so large valleys carved cheaply on a small
+	// map carry over, and finer levels only need a fraction of the droplets to add detail. The droplet
+	// count is that of the coarsest level, so the chain only runs faster than one level when that count
+	// is lowered too: the droplets of a level cost the same steps on any map size.
+	void erodeMultigrid() {
+		int levels = erosionLevels;
+		std::vector<unsigned int> levelTextures(levels), downsampledTextures(levels);
+		std::vector<int> levelWidths(levels), levelHeights(levels);
+		levelTextures[0] = textureId;
+		levelWidths[0] = width;
+		levelHeights[0] = height;
+
+		MultigridComputeShader multigrid;
+		for (int k = 1; k < levels; k++) {
+			levelWidths[k] = max(1, (levelWidths[k - 1] + 1) / 2);
+			levelHeights[k] = max(1, (levelHeights[k - 1] + 1) / 2);
+			glCreateTextures(GL_TEXTURE_2D, 1, &levelTextures[k]);
+			glTextureStorage2D(levelTextures[k], 1, GL_RGBA32F, levelWidths[k], levelHeights[k]);
+			glCreateTextures(GL_TEXTURE_2D, 1, &downsampledTextures[k]);
+			glTextureStorage2D(downsampledTextures[k], 1, GL_RGBA32F, levelWidths[k], levelHeights[k]);
+			multigrid.downsample(levelTextures[k - 1], levelTextures[k], levelWidths[k], levelHeights[k]);
+			glMemoryBarrier(GL_ALL_BARRIER_BITS);		// no single bit covers copies reading image stores
+			glCopyImageSubData(levelTextures[k], GL_TEXTURE_2D, 0, 0, 0, 0, downsampledTextures[k], GL_TEXTURE_2D, 0, 0, 0, 0, levelWidths[k], levelHeights[k], 1);
+		}
+
+		ErosionComputeShader computeShader;
+		float droplets = (float)erosionDroplets;
+		for (int k = levels - 1; k >= 0; k--) {
+			if (k < levels - 1) {
+				multigrid.propagate(levelTextures[k + 1], downsampledTextures[k + 1], levelTextures[k], levelWidths[k], levelHeights[k]);
+			}
+			glBindImageTexture(0, levelTextures[k], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+			computeShader.droplets = max(1, (int)droplets);
+			computeShader.Bind();
+			droplets *= erosionLevelDropletScale;
+		}
+
+		glBindImageTexture(0, textureId, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+		glDeleteTextures(levels - 1, &levelTextures[1]);
+		glDeleteTextures(levels - 1, &downsampledTextures[1]);
+	}
+
+	void erodeThermal() {
+		if (thermalErosionOnGPU) {
+			ThermalErosionComputeShader computeShader(width, height);
+			computeShader.Bind();
+		} else {
+			ThermalErosion thermal(width, height);
+			download();
+			thermal.erode(image);
+			upload();
+		}
+	}
+
+	// Flow direction and accumulation of the eroded map, computed on the CPU
+	void routeFlow() {
+		FlowRouting flow(width, height);
+		download();
+		flow.route(image);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		glCreateTextures(GL_TEXTURE_2D, 1, &flowDirectionTextureId);
+		glTextureStorage2D(flowDirectionTextureId, 1, GL_R8UI, width, height);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTextureSubImage2D(flowDirectionTextureId, 0, 0, 0, width, height, GL_RED_INTEGER, GL_UNSIGNED_BYTE, flow.direction.data());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		glCreateTextures(GL_TEXTURE_2D, 1, &flowAccumulationTextureId);
+		glTextureParameteri(flowAccumulationTextureId, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTextureParameteri(flowAccumulationTextureId, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureParameteri(flowAccumulationTextureId, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(flowAccumulationTextureId, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTextureStorage2D(flowAccumulationTextureId, 1, GL_R32F, width, height);
+		glTextureSubImage2D(flowAccumulationTextureId, 0, 0, 0, width, height, GL_RED, GL_FLOAT, flow.accumulation.data());
+		flowStats.uploadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// Lakes in every depression deeper than lakeMinDepth, filled up to where they would spill over
+	void fillDepressions() {
+		PriorityFlood flood(width, height);
+		download();
+		auto start = std::chrono::high_resolution_clock::now();
+		flood.fill(image);
+		flood.lakeLevels(image, lakeLevels);
+		auto filledTime = std::chrono::high_resolution_clock::now();
+		lakeStats.fillMs = std::chrono::duration<double, std::milli>(filledTime - start).count();
+
+		glCreateTextures(GL_TEXTURE_2D, 1, &lakeLevelTextureId);
+		glTextureParameteri(lakeLevelTextureId, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTextureParameteri(lakeLevelTextureId, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureParameteri(lakeLevelTextureId, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(lakeLevelTextureId, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTextureStorage2D(lakeLevelTextureId, 1, GL_R32F, width, height);
+		glTextureSubImage2D(lakeLevelTextureId, 0, 0, 0, width, height, GL_RED, GL_FLOAT, lakeLevels.data());
+		lakeStats.uploadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - filledTime).count();
+	}
+
+	// Height gradients of the final map, after the GPU passes are done
+	void computeNormals() {
+		NormalMap normals(width, height);
+		download();
+		normals.compute(image);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		glCreateTextures(GL_TEXTURE_2D, 1, &normalTextureId);
+		glTextureParameteri(normalTextureId, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTextureParameteri(normalTextureId, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTextureParameteri(normalTextureId, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTextureParameteri(normalTextureId, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTextureStorage2D(normalTextureId, 1, GL_RG16F, width, height);
+		glTextureSubImage2D(normalTextureId, 0, 0, 0, width, height, GL_RG, GL_FLOAT, normals.gradients.data());
+		normalStats.uploadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	// Noise height at map coordinates U, V, where [0, 1] is the generated map. The noise keeps frequency 1
+	// and the coordinates are scaled instead, so this is const and can be called from several threads.
+	float getHeightNormalized(float U, float V) const {
+		float height = 0;
+		float layerAmplitude = 1;
+		float layerFrequency = frequency;
+		float maxHeight = 0;
+
+		for (int i = 0; i < octaves; i++) {
+			maxHeight += layerAmplitude;
+			height += noise.GetNoise(U * layerFrequency, V * layerFrequency) * layerAmplitude;
+			layerAmplitude *= 0.5;
+			layerFrequency *= 2.0;
+		}
+
+		// Normalize height
+		float normalizedHeight = (height + maxHeight) / (2 * maxHeight);
+		if (normalizedHeight < 0.0) normalizedHeight = 0.0;
+		if (normalizedHeight > 1.0) normalizedHeight = 1.0;
+		return normalizedHeight;
+	}
+
+	// Bilinear sample of an image at uv like GL_LINEAR with clamping to the edge
+	static float sampleImage(const std::vector<vec4>& image, int width, int height, float u, float v) {
+		float x = u * width - 0.5f, y = v * height - 0.5f;
+		int x0 = (int)floorf(x), y0 = (int)floorf(y);
+		float tx = x - x0, ty = y - y0;
+		auto h = [&](int px, int py) { return image[max(0, min(py, height - 1)) * width + max(0, min(px, width - 1))].x; };
+		float top = h(x0, y0) + (h(x0 + 1, y0) - h(x0, y0)) * tx;
+		float bottom = h(x0, y0 + 1) + (h(x0 + 1, y0 + 1) - h(x0, y0 + 1)) * tx;
+		return top + (bottom - top) * ty;
+	}
+
+	// Of the CPU side image
+	float sampleHeight(float u, float v) const { return sampleImage(image, width, height, u, v); }
+
+	const std::vector<vec4>& getImage() { return image; }
+	const std::vector<float>& getLakeLevels() { return lakeLevels; }
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+
+	// Copy the texture into the CPU side image, e.g. after GPU erosion passes
+	void download() {
+		glGetTextureImage(textureId, 0, GL_RGBA, GL_FLOAT, (int)(image.size() * sizeof(vec4)), image.data());
+	}
+
+	void upload() {
+		glTextureSubImage2D(textureId, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, image.data());
 	}
 };
 
@@ -0,0 +1,141 @@
+#pragma once
+#include "framework.h"
+#include "terrainshader.h"
+
+bool terrainTessellation = false;
+float tessPixelsPerEdge = 8.0;		// target edge length on screen
+
+// Terrain on the tessellation stages. The vertex stage only lifts the patch corners onto the terrain,
+// the control stage picks a level for every patch edge from its length on screen, and the evaluation
+// stage places the generated vertices and samples their heights. The level of an edge depends only on
+// its two corners, so neighbouring patches split a shared edge the same way and no cracks open.
+// Patches whose terrain box is outside the frustum get level 0 and are dropped. The fragment stage is
+// the one of TerrainShader.
+class TessTerrainShader : public TerrainShader {
+	const char* tessVertexSource = R"(
+		#version 450 core
+		precision highp float;
+
+		#include <uniformblocks>
+
+		layout(binding = 0) uniform sampler2D terrainTexture;
+		uniform float gridScale;
+
+		layout(location = 0) in vec3  vtxPos;            // patch corner in modeling space
+		layout(location = 1) in vec2  vtxUV;
+
+		out vec3 cornerPos;
+
+		void main() {
+			cornerPos = vec3(vtxPos.x, texture(terrainTexture, vtxUV).r * terrainAmplitude, vtxPos.z);
+		}
+	)";
+
+	const char* tessControlSource = R"(
+		#version 450 core
+		precision highp float;
+
+		layout(vertices = 4) out;
+
+		#include <uniformblocks>
+
+		uniform float projScale;		// pixels per unit of length at unit distance
+		uniform float pixelsPerEdge;
+
+		in vec3 cornerPos[];
+		out vec3 patchPos[];
+
+		// Projected size of the sphere around an edge, so the level does not depend on the view angle
+		float edgeLevel(vec3 a, vec3 b) {
+			float pixels = length(a - b) * projScale / max(length(0.5 * (a + b) - wEye), 0.001);
+			return clamp(pixels / pixelsPerEdge, 1.0, 64.0);
+		}
+
+		// Whether the box from sea floor to the highest terrain over the patch is outside one clip plane
+		bool outside() {
+			vec4 clip[8];
+			for (int i = 0; i < 4; i++) {
+				clip[2 * i] = vec4(cornerPos[i].x, 0.0, cornerPos[i].z, 1.0) * MVP;
+				clip[2 * i + 1] = vec4(cornerPos[i].x, terrainAmplitude, cornerPos[i].z, 1.0) * MVP;
+			}
+			for (int axis = 0; axis < 3; axis++) {
+				bool below = true, above = true;
+				for (int i = 0; i < 8; i++) {
+					below = below && clip[i][axis] < -clip[i].w;
+					above = above && clip[i][axis] > clip[i].w;
+				}
+				if (below || above) return true;
+			}
+			return false;
+		}
+
+		void main() {
+			patchPos[gl_InvocationID] = cornerPos[gl_InvocationID];
+			if (gl_InvocationID == 0) {
+				if (outside()) {
+					gl_TessLevelOuter[0] = gl_TessLevelOuter[1] = gl_TessLevelOuter[2] = gl_TessLevelOuter[3] = 0.0;
+					gl_TessLevelInner[0] = gl_TessLevelInner[1] = 0.0;
+					return;
+				}
+				// Corners 0, 1, 2, 3 = (u, v) 00, 10, 11, 01, outer edges u = 0, v = 0, u = 1, v = 1
+				gl_TessLevelOuter[0] = edgeLevel(cornerPos[3], cornerPos[0]);
+				gl_TessLevelOuter[1] = edgeLevel(cornerPos[0], cornerPos[1]);
+				gl_TessLevelOuter[2] = edgeLevel(cornerPos[1], cornerPos[2]);
+				gl_TessLevelOuter[3] = edgeLevel(cornerPos[2], cornerPos[3]);
+				gl_TessLevelInner[0] = max(gl_TessLevelOuter[1], gl_TessLevelOuter[3]);
+				gl_TessLevelInner[1] = max(gl_TessLevelOuter[0], gl_TessLevelOuter[2]);
+			}
+		}
+	)";
+
+	const char* tessEvaluationSource = R"(
+		#version 450 core
+		precision highp float;
+
+		layout(quads, fractional_even_spacing, ccw) in;
+
+		#include <uniformblocks>
+
+		layout(binding = 0) uniform sampler2D terrainTexture;
+		uniform float gridScale;
+
+		in vec3 patchPos[];
+
+		out vec3 wView;             // view in world space
+		out vec3 wLight[8];		    // light dir in world space
+		out vec2 texcoord;
+		out float height;			// Terrain Height
+		out float distance;			// Distance from camera
+
+		void main() {
+			vec2 t = gl_TessCoord.xy;
+			vec3 vertexPos = mix(mix(patchPos[0], patchPos[1], t.x), mix(patchPos[3], patchPos[2], t.x), t.y);
+			vec2 uv = vertexPos.xz / gridScale + 0.5;
+			vertexPos.y = texture(terrainTexture, uv).r * terrainAmplitude;
+			gl_Position = vec4(vertexPos, 1) * MVP; // to NDC
+			vec4 wPos = vec4(vertexPos, 1) * M;
+			for(int i = 0; i < nLights; i++) {
+				wLight[i] = lights[i].wLightPos.xyz * wPos.w - wPos.xyz * lights[i].wLightPos.w;
+			}
+		    wView  = wEye * wPos.w - wPos.xyz;
+		    texcoord = uv;
+			height = wPos.y;
+			distance = length(wPos.xyz - wEye);
+		}
+	)";
+
+	int projScaleLocation, pixelsPerEdgeLocation;
+
+public:
+	TessTerrainShader() : TerrainShader(false) {
+		create(tessVertexSource, fragmentSource, "fragmentColor", nullptr, tessControlSource, tessEvaluationSource);
+		projScaleLocation = getLocation("projScale");
+		pixelsPerEdgeLocation = getLocation("pixelsPerEdge");
+	}
+
+	void Bind(RenderState state) {
+		TerrainShader::Bind(state);
+		glUniform1f(projScaleLocation, state.P[1][1] * windowHeight / 2.0f);
+		glUniform1f(pixelsPerEdgeLocation, tessPixelsPerEdge);
+	}
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include "framework.h"
+#include "parallel.h"
+#include "thermalerosioncomputeshader.h"
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define THERMAL_EROSION_SSE
+#endif
+
+// CPU version of ThermalErosionComputeShader: the same gather stencil, four cells at a time with SSE,
+// rows split over threads. The terrain is stored with a one texel replicated border so that the
+// stencil needs no bounds checks and edge cells see a flat neighbour, like the clamped GPU fetches.
+class ThermalErosion {
+	int width, height, stride;
+	std::vector<float> terrain[2];
+	float talus, diagonalTalus, transferRate;
+
+	float* row(int k, int y) { return terrain[k].data() + (y + 1) * stride + 1; }
+
+	float transfer(float h, float neighbour, float threshold) {
+		return transferRate * (max(neighbour - h - threshold, 0.0f) - max(h - neighbour - threshold, 0.0f));
+	}
+
+	void replicateBorder(int k) {
+		for (int y = 0; y < height; y++) {
+			row(k, y)[-1] = row(k, y)[0];
+			row(k, y)[width] = row(k, y)[width - 1];
+		}
+		memcpy(row(k, -1) - 1, row(k, 0) - 1, stride * sizeof(float));
+		memcpy(row(k, height) - 1, row(k, height - 1) - 1, stride * sizeof(float));
+	}
+
+	void iterateRow(int y) {
+		const float* above = row(0, y - 1);
+		const float* center = row(0, y);
+		const float* below = row(0, y + 1);
+		float* out = row(1, y);
+		int x = 0;
+
+#ifdef THERMAL_EROSION_SSE
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 rate = _mm_set1_ps(transferRate);
+		const __m128 straight = _mm_set1_ps(talus);
+		const __m128 diagonal = _mm_set1_ps(diagonalTalus);
+		auto transfer4 = [&](__m128 h, __m128 neighbour, __m128 threshold) {
+			__m128 gain = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(neighbour, h), threshold), zero);
+			__m128 loss = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(h, neighbour), threshold), zero);
+			return _mm_mul_ps(rate, _mm_sub_ps(gain, loss));
+		};
+
+		for (; x + 4 <= width; x += 4) {
+			__m128 h = _mm_loadu_ps(center + x);
+			__m128 delta = zero;
+			delta = _mm_add_ps(delta, transfer4(h, _mm_loadu_ps(center + x - 1), straight));
+			delta = _mm_add_ps(delta, transfer4(h, _mm_loadu_ps(center + x + 1), straight));
+			delta = _mm_add_ps(delta, transfer4(h, _mm_loadu_ps(above + x), straight));
+			delta = _mm_add_ps(delta, transfer4(h, _mm_loadu_ps(below + x), straight));
+			delta = _mm_add_ps(delta, transfer4(h, _mm_loadu_ps(above + x - 1), diagonal));
+			delta = _mm_add_ps(delta, transfer4(h, _mm_loadu_ps(above + x + 1), diagonal));
+			delta = _mm_add_ps(delta, transfer4(h, _mm_loadu_ps(below + x - 1), diagonal));
+			delta = _mm_add_ps(delta, transfer4(h, _mm_loadu_ps(below + x + 1), diagonal));
+			_mm_storeu_ps(out + x, _mm_add_ps(h, delta));
+		}
+#endif
+
+		// Remainder, same order of operations as the vector loop and the compute shader
+		for (; x < width; x++) {
+			float h = center[x];
+			float delta = 0.0f;
+			delta += transfer(h, center[x - 1], talus);
+			delta += transfer(h, center[x + 1], talus);
+			delta += transfer(h, above[x], talus);
+			delta += transfer(h, below[x], talus);
+			delta += transfer(h, above[x - 1], diagonalTalus);
+			delta += transfer(h, above[x + 1], diagonalTalus);
+			delta += transfer(h, below[x - 1], diagonalTalus);
+			delta += transfer(h, below[x + 1], diagonalTalus);
+			out[x] = h + delta;
+		}
+	}
+
+public:
+	ThermalErosion(int _width, int _height) {
+		width = _width;
+		height = _height;
+		stride = width + 2;
+		terrain[0].resize(stride * (height + 2));
+		terrain[1].resize(stride * (height + 2));
+	}
+
+	void erode(std::vector<vec4>& image) {
+		talus = tanf(radians(thermalTalusAngle));
+		diagonalTalus = talus * sqrtf(2.0f);
+		transferRate = thermalRate / 16.0f;
+
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) row(0, y)[x] = image[y * width + x].x * terrainAmplitude;
+		}
+		replicateBorder(0);
+
+		for (int iteration = 0; iteration < thermalIterations; iteration++) {
+			parallelFor(0, height, [this](int y) { iterateRow(y); });
+			std::swap(terrain[0], terrain[1]);
+			replicateBorder(0);
+		}
+
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				float h = row(0, y)[x] / terrainAmplitude;
+				image[y * width + x] = vec4(h, h, h, 1);
+			}
+		}
+	}
+};
@@ -0,0 +1,131 @@
+#pragma once
+#include "framework.h"
+#include "computeshader.h"
+#include "erosioncomputeshader.h"
+
+bool thermalErosion = false;
+bool thermalErosionOnGPU = true;
+int thermalIterations = 50;
+float thermalTalusAngle = 30.0;		// degrees, a texel is one unit wide
+float thermalRate = 0.5;
+
+enum ThermalErosionOrder { THERMAL_BEFORE_HYDRAULIC, THERMAL_AFTER_HYDRAULIC };
+int thermalErosionOrder = THERMAL_AFTER_HYDRAULIC;
+
+// Passes of the shader, the same numbers as the constants in its source
+enum ThermalErosionPass {
+	THERMAL_PASS_INIT,			// heightmap -> terrain buffer
+	THERMAL_PASS_ITERATE,		// one step of the talus transfer between the two terrain buffers
+	THERMAL_PASS_WRITEBACK		// terrain buffer -> heightmap
+};
+
+// Material moved from a cell towards a neighbour per iteration is rate/16 of the height difference
+// above the talus threshold. The same pairwise term is added on the receiving side, so each pass only
+// gathers from neighbours, conserves material and needs nothing but a second buffer to stay deterministic.
+class ThermalErosionComputeShader : ComputeShader {
+	const char* computeShaderSource = R"(
+		#version 450 core
+
+		layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+		layout(rgba32f, binding = 0) uniform image2D heightMap;
+
+		layout(std430, binding = 0) buffer TerrainIn { float terrainIn[]; };
+		layout(std430, binding = 1) buffer TerrainOut { float terrainOut[]; };
+
+		const int PASS_INIT = 0;
+		const int PASS_ITERATE = 1;
+		const int PASS_WRITEBACK = 2;
+
+		// Parameters
+		uniform int pass;
+		uniform float terrainAmplitude;
+		uniform float talus;
+		uniform float transferRate;
+
+		int cell(int x, int y) {
+			ivec2 dimensions = imageSize(heightMap);
+			return clamp(y, 0, dimensions.y - 1) * dimensions.x + clamp(x, 0, dimensions.x - 1);
+		}
+
+		float transfer(float h, float neighbour, float threshold) {
+			return transferRate * (max(neighbour - h - threshold, 0.0) - max(h - neighbour - threshold, 0.0));
+		}
+
+		void main() {
+			ivec2 dimensions = imageSize(heightMap);
+			ivec2 p = ivec2(gl_GlobalInvocationID.xy);
+			if (p.x >= dimensions.x || p.y >= dimensions.y) return;
+			int i = cell(p.x, p.y);
+
+			if (pass == PASS_INIT) {
+				terrainIn[i] = imageLoad(heightMap, p).r * terrainAmplitude;
+			}
+			else if (pass == PASS_ITERATE) {
+				float h = terrainIn[i];
+				float diagonalTalus = talus * sqrt(2.0);
+				float delta = 0.0;
+				delta += transfer(h, terrainIn[cell(p.x - 1, p.y)], talus);
+				delta += transfer(h, terrainIn[cell(p.x + 1, p.y)], talus);
+				delta += transfer(h, terrainIn[cell(p.x, p.y - 1)], talus);
+				delta += transfer(h, terrainIn[cell(p.x, p.y + 1)], talus);
+				delta += transfer(h, terrainIn[cell(p.x - 1, p.y - 1)], diagonalTalus);
+				delta += transfer(h, terrainIn[cell(p.x + 1, p.y - 1)], diagonalTalus);
+				delta += transfer(h, terrainIn[cell(p.x - 1, p.y + 1)], diagonalTalus);
+				delta += transfer(h, terrainIn[cell(p.x + 1, p.y + 1)], diagonalTalus);
+				terrainOut[i] = h + delta;
+			}
+			else if (pass == PASS_WRITEBACK) {
+				float h = terrainIn[i] / terrainAmplitude;
+				imageStore(heightMap, p, vec4(h, h, h, 1.0));
+			}
+		}
+		)";
+
+	int width, height;
+	unsigned int terrainBuffers[2];
+
+	void dispatch(ThermalErosionPass pass) {
+		setUniform("pass", pass);
+		glDispatchCompute((width + 15) / 16, (height + 15) / 16, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+public:
+	ThermalErosionComputeShader(int _width, int _height) {
+		width = _width;
+		height = _height;
+		create(computeShaderSource);
+
+		glCreateBuffers(2, terrainBuffers);
+		for (unsigned int buffer : terrainBuffers) {
+			glNamedBufferStorage(buffer, width * height * sizeof(float), nullptr, 0);
+		}
+	}
+
+	void Bind() {
+		glUseProgram(getId());	// make this program run
+
+		setUniform("terrainAmplitude", terrainAmplitude);
+		setUniform("talus", tanf(radians(thermalTalusAngle)));
+		setUniform("transferRate", thermalRate / 16.0f);
+
+		int terrainIn = 0;
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, terrainBuffers[terrainIn]);
+		dispatch(THERMAL_PASS_INIT);
+
+		for (int iteration = 0; iteration < thermalIterations; iteration++) {
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, terrainBuffers[terrainIn]);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, terrainBuffers[1 - terrainIn]);
+			dispatch(THERMAL_PASS_ITERATE);
+			terrainIn = 1 - terrainIn;
+		}
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, terrainBuffers[terrainIn]);
+		dispatch(THERMAL_PASS_WRITEBACK);
+		glMemoryBarrier(GL_ALL_BARRIER_BITS);
+	}
+
+	~ThermalErosionComputeShader() {
+		glDeleteBuffers(2, terrainBuffers);
+	}
+};
@@ -0,0 +1,169 @@
+#pragma once
+#include "framework.h"
+#include "parallel.h"
+#include "erosioncomputeshader.h"
+#include <algorithm>
+
+bool erosionTiled = false;
+int erosionTileSize = 128;		// core texels per side
+int erosionTileHalo = 32;		// texels around the core that droplets may run into, at most half the core
+int erosionTileBatch = 16;		// tiles of one colour in flight at once, each holds a texture
+
+// Storage the tiles are read from and written back to, row by row. Tiles of one colour never overlap,
+// so read and write are called for several of them at once from different threads.
+class HeightStore {
+public:
+	virtual int getWidth() = 0;
+	virtual int getHeight() = 0;
+	virtual void read(int x0, int y0, int w, int h, vec4* heights) = 0;
+	virtual void write(int x0, int y0, int w, int h, const vec4* heights) = 0;
+	virtual ~HeightStore() {}
+};
+
+// The CPU copy of a whole map
+class ImageHeightStore : public HeightStore {
+	std::vector<vec4>& image;
+	int width, height;
+
+public:
+	ImageHeightStore(std::vector<vec4>& _image, int _width, int _height) : image(_image) {
+		width = _width;
+		height = _height;
+	}
+
+	int getWidth() { return width; }
+	int getHeight() { return height; }
+
+	void read(int x0, int y0, int w, int h, vec4* heights) {
+		for (int y = 0; y < h; y++) std::copy_n(&image[(y0 + y) * width + x0], w, heights + y * w);
+	}
+
+	void write(int x0, int y0, int w, int h, const vec4* heights) {
+		for (int y = 0; y < h; y++) std::copy_n(heights + y * w, w, &image[(y0 + y) * width + x0]);
+	}
+};
+
+// Droplet erosion of a map of any size, one tile sized texture per tile. The map is cut into square
+// cores, and each tile is its core grown by a halo. Droplets spawn only inside the core, so every
+// texel gets the same droplet density, and the cost grows with the map area. Changes in the halo are
+// faded out towards its outer edge before they go back into the map, which hides the seams.
+//
+// Tiles are processed by colour, where the colour is the parity of the tile column and row. Two tiles
+// of the same colour are at least one core apart, so their regions never overlap as long as the halo
+// is at most half the core. The tiles of a colour therefore run as a batch: their regions are read
+// from the store on the pool threads, uploaded and eroded one after the other, then read back,
+// blended and written back on the pool threads. Between the dispatches the CPU only waits for the
+// timer of the dispatch before the last, so the GPU always has the next one queued, and the droplet
+// counters of the batch are read once after its last tile.
+class TiledErosion {
+	struct Tile {
+		int coreX0, coreY0, coreX1, coreY1;
+		int x0, y0, w, h;
+		int seed;
+		std::vector<vec4> heights, eroded;
+		unsigned int texture = 0;
+	};
+
+	int width, height;
+	int tileSize, halo;
+
+	// 1 inside the core, falling smoothly to 0 just past the outer edge of the halo
+	float feather(int distance) {
+		float t = 1.0f - (float)distance / (halo + 1);
+		return t * t * (3.0f - 2.0f * t);
+	}
+
+	Tile makeTile(int tx, int ty) {
+		Tile tile;
+		tile.coreX0 = tx * tileSize;
+		tile.coreY0 = ty * tileSize;
+		tile.coreX1 = min(tile.coreX0 + tileSize, width);
+		tile.coreY1 = min(tile.coreY0 + tileSize, height);
+		tile.x0 = max(tile.coreX0 - halo, 0);
+		tile.y0 = max(tile.coreY0 - halo, 0);
+		tile.w = min(tile.coreX1 + halo, width) - tile.x0;
+		tile.h = min(tile.coreY1 + halo, height) - tile.y0;
+		tile.seed = terrainSeed + (ty * 65536 + tx) * 31;
+		return tile;
+	}
+
+	void dispatchTile(Tile& tile, ErosionComputeShader& computeShader) {
+		glCreateTextures(GL_TEXTURE_2D, 1, &tile.texture);
+		glTextureStorage2D(tile.texture, 1, GL_RGBA32F, tile.w, tile.h);
+		glTextureSubImage2D(tile.texture, 0, 0, 0, tile.w, tile.h, GL_RGBA, GL_FLOAT, tile.heights.data());
+		glBindImageTexture(0, tile.texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+
+		long long coreArea = (long long)(tile.coreX1 - tile.coreX0) * (tile.coreY1 - tile.coreY0);
+		computeShader.droplets = max(1, (int)(erosionDroplets * coreArea / ((long long)width * height)));
+		computeShader.seed = tile.seed;
+		computeShader.spawnOrigin = vec2((float)(tile.coreX0 - tile.x0) / tile.w, (float)(tile.coreY0 - tile.y0) / tile.h);
+		computeShader.spawnSize = vec2((float)(tile.coreX1 - tile.coreX0) / tile.w, (float)(tile.coreY1 - tile.coreY0) / tile.h);
+		computeShader.erode();
+		erosionStats.tiles++;
+	}
+
+	// The change faded out across the halo, into the heights read before the erosion
+	void blendTile(Tile& tile) {
+		for (int y = 0; y < tile.h; y++) {
+			int my = tile.y0 + y;
+			int dy = max(max(tile.coreY0 - my, my - (tile.coreY1 - 1)), 0);
+			for (int x = 0; x < tile.w; x++) {
+				int mx = tile.x0 + x;
+				int dx = max(max(tile.coreX0 - mx, mx - (tile.coreX1 - 1)), 0);
+				float weight = feather(dx) * feather(dy);
+				float& mapHeight = tile.heights[y * tile.w + x].x;
+				float blended = mapHeight + weight * (tile.eroded[y * tile.w + x].x - mapHeight);
+				tile.heights[y * tile.w + x] = vec4(blended, blended, blended, 1);
+			}
+		}
+	}
+
+	void erodeBatch(HeightStore& store, std::vector<Tile>& tiles, ErosionComputeShader& computeShader) {
+		int n = (int)tiles.size();
+		parallelFor(0, n, [&](int i) {
+			tiles[i].heights.resize(tiles[i].w * tiles[i].h);
+			store.read(tiles[i].x0, tiles[i].y0, tiles[i].w, tiles[i].h, tiles[i].heights.data());
+		});
+		for (Tile& tile : tiles) dispatchTile(tile, computeShader);
+		computeShader.collectStats();
+		for (Tile& tile : tiles) {
+			tile.eroded.resize(tile.w * tile.h);
+			glGetTextureSubImage(tile.texture, 0, 0, 0, 0, tile.w, tile.h, 1, GL_RGBA, GL_FLOAT, (int)(tile.eroded.size() * sizeof(vec4)), tile.eroded.data());
+			glDeleteTextures(1, &tile.texture);
+		}
+		parallelFor(0, n, [&](int i) {
+			blendTile(tiles[i]);
+			store.write(tiles[i].x0, tiles[i].y0, tiles[i].w, tiles[i].h, tiles[i].heights.data());
+		});
+	}
+
+public:
+	TiledErosion() {
+		tileSize = max(16, erosionTileSize);
+		halo = max(0, min(erosionTileHalo, tileSize / 2));
+	}
+
+	// Leaves image unit 0 bound to a deleted tile texture, the caller rebinds its own
+	void erode(HeightStore& store) {
+		width = store.getWidth();
+		height = store.getHeight();
+		int tilesX = (width + tileSize - 1) / tileSize;
+		int tilesY = (height + tileSize - 1) / tileSize;
+		int batchSize = max(1, erosionTileBatch);
+
+		ErosionComputeShader computeShader;
+		for (int colour = 0; colour < 4; colour++) {
+			std::vector<Tile> batch;
+			for (int ty = colour / 2; ty < tilesY; ty += 2) {
+				for (int tx = colour % 2; tx < tilesX; tx += 2) {
+					batch.push_back(makeTile(tx, ty));
+					if ((int)batch.size() == batchSize) {
+						erodeBatch(store, batch, computeShader);
+						batch.clear();
+					}
+				}
+			}
+			if (!batch.empty()) erodeBatch(store, batch, computeShader);
+		}
+	}
+};
@@ -0,0 +1,142 @@
+#pragma once
+#include "framework.h"
+#include <cstring>
+
+// Binding points of the uniform blocks, the same in every program
+const int FRAME_BLOCK = 0;
+const int LIGHT_BLOCK = 1;
+const int MATERIAL_BLOCK = 2;
+const int OBJECT_BLOCK = 3;
+const int MAX_LIGHTS = 8;
+
+// Declarations of the blocks, Shader::create puts them in place of the line #include <uniformblocks>
+// of a stage. The matrices are row major like mat4, so they are copied without a transpose.
+const char* const UNIFORM_BLOCKS_INCLUDE = "#include <uniformblocks>";
+const char* const uniformBlocksSource = R"(
+		struct Light {
+			vec3 La, Le;
+			vec4 wLightPos;
+		};
+
+		struct Material {
+			vec3 kd, ks, ka;
+			float shininess;
+		};
+
+		layout(std140, binding = 0) uniform FrameBlock {
+			vec3  wEye;					// Eye position
+			float time;					// Current time in ms
+			vec3  fogColor;
+			float terrainAmplitude;
+			float waterLevel;
+			float waveLength;
+			float waveAmplitude;
+			float waterAlpha;
+			float slopeScale;			// amplitude over the terrain size
+			float riverThreshold;
+			int   showRivers;
+		};
+
+		layout(std140, binding = 1) uniform LightBlock {
+			Light lights[8];			// Light sources
+			int   nLights;
+		};
+
+		layout(std140, binding = 2) uniform MaterialBlock {
+			Material material;
+		};
+
+		layout(std140, row_major, binding = 3) uniform ObjectBlock {
+			mat4  MVP, M;				// MVP, Model
+		};
+)";
+
+// std140 images of the blocks, vec3 members are padded to 16 bytes unless a float follows, and every
+// block is padded to a multiple of 16 bytes
+struct FrameUniforms {
+	vec3 wEye;
+	float time = 0;
+	vec3 fogColor;
+	float terrainAmplitude = 0;
+	float waterLevel = 0;
+	float waveLength = 0;
+	float waveAmplitude = 0;
+	float waterAlpha = 0;
+	float slopeScale = 0;
+	float riverThreshold = 0;
+	int showRivers = 0;
+	int pad0 = 0;
+};
+static_assert(sizeof(FrameUniforms) == 64, "FrameUniforms does not match FrameBlock");
+
+struct LightUniforms {
+	struct {
+		vec3 La;
+		float pad0 = 0;
+		vec3 Le;
+		float pad1 = 0;
+		vec4 wLightPos;
+	} lights[MAX_LIGHTS];
+	int nLights = 0;
+	int pad[3] = { 0, 0, 0 };
+};
+static_assert(sizeof(LightUniforms) == 400, "LightUniforms does not match LightBlock");
+
+struct MaterialUniforms {
+	vec3 kd;
+	float pad0 = 0;
+	vec3 ks;
+	float pad1 = 0;
+	vec3 ka;
+	float shininess = 0;
+};
+static_assert(sizeof(MaterialUniforms) == 48, "MaterialUniforms does not match MaterialBlock");
+
+struct ObjectUniforms {
+	mat4 MVP, M;
+};
+static_assert(sizeof(ObjectUniforms) == 128, "ObjectUniforms does not match ObjectBlock");
+
+// Uniform uploads and binds of this frame
+struct UniformStats {
+	int binds = 0;				// shader and block binds before draws
+	int uploads = 0;			// blocks whose data changed
+	int skipped = 0;			// and those that did not
+	double drawMs = 0;			// CPU time of the binds and the draws they are for
+
+	void newFrame() {
+		binds = 0;
+		uploads = 0;
+		skipped = 0;
+		drawMs = 0;
+	}
+};
+
+UniformStats uniformStats;
+
+// Buffer of one block. It is created on the first update, since the owners may be built before the
+// context, and uploads only when the data differs from what it holds.
+template <typename T>
+class UniformBuffer {
+	unsigned int bufferId = 0;
+	T data;
+
+public:
+	~UniformBuffer() { if (bufferId > 0) glDeleteBuffers(1, &bufferId); }
+
+	void update(const T& value) {
+		if (bufferId == 0) {
+			glCreateBuffers(1, &bufferId);
+			glNamedBufferStorage(bufferId, sizeof(T), nullptr, GL_DYNAMIC_STORAGE_BIT);
+		}
+		else if (memcmp(&value, &data, sizeof(T)) == 0) {
+			uniformStats.skipped++;
+			return;
+		}
+		data = value;
+		glNamedBufferSubData(bufferId, 0, sizeof(T), &data);
+		uniformStats.uploads++;
+	}
+
+	void bind(int binding) { glBindBufferBase(GL_UNIFORM_BUFFER, binding, bufferId); }
+};
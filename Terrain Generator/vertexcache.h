@@ -0,0 +1,146 @@
+#pragma once
+#include "framework.h"
+#include <algorithm>
+
+const int VERTEX_CACHE_LRU = 32;		// cache the ordering optimizes for
+const int VERTEX_CACHE_FIFO = 16;		// cache the miss ratio is measured with, smaller than most GPUs have
+
+// Average cache miss ratio, transformed vertices per triangle, of the meshes built last
+struct VertexCacheStats {
+	float gridStripAcmr = 0;		// row strips
+	float gridMortonAcmr = 0;		// quads in Morton order
+	float gridAcmr = 0;				// and after the optimization
+	double gridOptimizeMs = 0;
+	float adaptiveTraversalAcmr = 0;
+	float adaptiveAcmr = 0;
+	double adaptiveOptimizeMs = 0;	// on the worker thread
+};
+
+VertexCacheStats vertexCacheStats;
+
+// Position of a grid point along the Z-order curve
+inline unsigned int mortonCode(unsigned int x, unsigned int y) {
+	auto spread = [](unsigned int v) {
+		v &= 0xFFFF;
+		v = (v | (v << 8)) & 0x00FF00FF;
+		v = (v | (v << 4)) & 0x0F0F0F0F;
+		v = (v | (v << 2)) & 0x33333333;
+		v = (v | (v << 1)) & 0x55555555;
+		return v;
+	};
+	return spread(x) | (spread(y) << 1);
+}
+
+// Transformed vertices per triangle with a FIFO post-transform cache of cacheSize vertices. Works on
+// strips as well as lists, since the cache only sees the index stream; restart indices are skipped.
+inline float vertexCacheAcmr(const std::vector<unsigned int>& indices, long long triangles, int cacheSize = VERTEX_CACHE_FIFO) {
+	if (triangles == 0) return 0;
+	unsigned int vertexCount = 0;
+	for (unsigned int i : indices) if (i != 0xFFFFFFFF) vertexCount = max(vertexCount, i + 1);
+	std::vector<long long> insertedAt(vertexCount, -(long long)cacheSize - 1);		// miss count when the vertex entered
+	long long misses = 0;
+	for (unsigned int i : indices) {
+		if (i == 0xFFFFFFFF || misses - insertedAt[i] < cacheSize) continue;
+		insertedAt[i] = misses++;
+	}
+	return (float)misses / triangles;
+}
+
+// Tom Forsyth's linear-speed vertex cache optimisation of a triangle list. Vertices score higher the
+// more recently they were used and the fewer triangles they have left, so that lone triangles get
+// finished instead of stranded, and the next triangle is the best scored one around the vertices
+// of a simulated LRU cache. When none of those has triangles left, the first one not emitted yet
+// starts a new run.
+inline void optimizeVertexCache(std::vector<unsigned int>& indices, int vertexCount) {
+	int triangleCount = (int)indices.size() / 3;
+	auto vertexScore = [](int cachePosition, int remaining) {
+		if (remaining == 0) return -1.0f;
+		float score = 0;
+		if (cachePosition >= 0) {
+			if (cachePosition < 3) score = 0.75f;		// the last triangle, no gain from using it again
+			else score = powf(1.0f - (float)(cachePosition - 3) / (VERTEX_CACHE_LRU - 3), 1.5f);
+		}
+		return score + 2.0f / sqrtf((float)remaining);
+	};
+
+	// Triangles of every vertex, the ones still to emit at the front of its range
+	std::vector<int> remaining(vertexCount, 0), offsets(vertexCount + 1, 0);
+	for (unsigned int i : indices) remaining[i]++;
+	for (int v = 0; v < vertexCount; v++) offsets[v + 1] = offsets[v] + remaining[v];
+	std::vector<int> adjacency(indices.size()), cursor(offsets.begin(), offsets.end() - 1);
+	for (int t = 0; t < triangleCount; t++) {
+		for (int k = 0; k < 3; k++) adjacency[cursor[indices[t * 3 + k]]++] = t;
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> score(vertexCount), triangleScore(triangleCount);
+	for (int v = 0; v < vertexCount; v++) score[v] = vertexScore(-1, remaining[v]);
+	for (int t = 0; t < triangleCount; t++) triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+
+	std::vector<char> emitted(triangleCount, 0);
+	std::vector<unsigned int> ordered;
+	ordered.reserve(indices.size());
+	std::vector<int> cache, grown;
+	int best = 0, next = 0;
+	while ((int)ordered.size() < triangleCount * 3) {
+		if (best < 0) {
+			while (emitted[next]) next++;
+			best = next;
+		}
+		emitted[best] = 1;
+		const unsigned int* triangle = &indices[best * 3];
+		ordered.insert(ordered.end(), triangle, triangle + 3);
+
+		// The triangle leaves the lists of its vertices, which move to the front of the cache
+		grown.assign(triangle, triangle + 3);
+		for (int k = 0; k < 3; k++) {
+			int v = triangle[k];
+			int* first = &adjacency[offsets[v]];
+			int* last = first + --remaining[v];
+			*std::find(first, last + 1, best) = *last;
+		}
+		for (int v : cache) {
+			if (v != (int)triangle[0] && v != (int)triangle[1] && v != (int)triangle[2]) grown.push_back(v);
+		}
+		for (int i = 0; i < (int)grown.size(); i++) cachePosition[grown[i]] = i < VERTEX_CACHE_LRU ? i : -1;
+
+		// Rescore what was in the cache, including the vertices pushed out, and pick the best triangle
+		best = -1;
+		float bestScore = -1;
+		for (int v : grown) score[v] = vertexScore(cachePosition[v], remaining[v]);
+		for (int v : grown) {
+			for (int a = offsets[v]; a < offsets[v] + remaining[v]; a++) {
+				int t = adjacency[a];
+				triangleScore[t] = score[indices[t * 3]] + score[indices[t * 3 + 1]] + score[indices[t * 3 + 2]];
+				if (triangleScore[t] > bestScore) {
+					bestScore = triangleScore[t];
+					best = t;
+				}
+			}
+		}
+		grown.resize(min((int)grown.size(), VERTEX_CACHE_LRU));
+		cache.swap(grown);
+	}
+	indices.swap(ordered);
+}
+
+// Renumbers the vertices in the order the indices first use them, so that the vertex fetches walk
+// through memory. Returns the new index of every old vertex.
+inline std::vector<unsigned int> optimizeVertexFetch(std::vector<unsigned int>& indices, int vertexCount) {
+	std::vector<unsigned int> remap(vertexCount, 0xFFFFFFFF);
+	unsigned int next = 0;
+	for (unsigned int& i : indices) {
+		if (remap[i] == 0xFFFFFFFF) remap[i] = next++;
+		i = remap[i];
+	}
+	for (unsigned int& r : remap) if (r == 0xFFFFFFFF) r = next++;
+	return remap;
+}
+
+// Moves every element to its new index
+template <typename T>
+void remapVertices(std::vector<T>& data, const std::vector<unsigned int>& remap) {
+	std::vector<T> moved(data.size());
+	for (size_t i = 0; i < data.size(); i++) moved[remap[i]] = data[i];
+	data.swap(moved);
+}
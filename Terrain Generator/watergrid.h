@@ -0,0 +1,207 @@
+#pragma once
+#include "framework.h"
+#include "geometry.h"
+#include "terraintexture.h"
+#include "renderstate.h"
+#include "frustum.h"
+
+bool waterTiles = true;			// false draws the water over the terrain geometry, for comparison
+int waterQuadsPerWave = 8;		// grid density of the nearest tiles
+
+const int WATER_TILES = 16;				// tiles per side of the plane
+const int WATER_MAX_GRID = 64;			// quads per tile side
+const float WATER_LOD_DISTANCE = 4.0f;	// in tiles, where the grid first halves
+
+// Water of the last frame
+struct WaterStats {
+	int tiles = 0;					// with terrain below the surface
+	int visible = 0;
+	long long vertices = 0;
+	long long planeVertices = 0;	// of the terrain grid the water used before
+	double selectMs = 0;
+	long long rasterizedTiles = 0;	// water fragments with the depth test off, from "Compare water"
+	long long rasterizedPlane = 0;
+	long long passedTiles = 0;		// and with the depth test on
+	long long passedPlane = 0;
+};
+
+WaterStats waterStats;
+
+// Water surface on its own grid of square tiles. A tile is drawn only if the terrain under it reaches
+// below the water or a lake surface, with some room for the waves, and it is inside the frustum. The
+// grid spacing follows the wave length and doubles with the distance from the eye. Where a tile meets
+// a coarser neighbour, the vertex shader snaps its edge vertices onto the coarser ones, so no cracks
+// open when the waves displace both.
+class WaterGrid : public Geometry {
+	struct Tile {
+		int x, y;
+		int grid;		// quads per side, a power of two
+	};
+
+	float scale;
+	Geometry* plane;			// the terrain geometry, drawn when the tiles are off
+	TerrainTexture* texture = nullptr;
+	std::vector<float> tileMin;			// normalized terrain minimum per tile
+	std::vector<float> tileLake;		// highest lake surface per tile, 0 without lakes
+	std::vector<int> tileGrid;			// quads per side of the tiles of this frame, 0 when not drawn
+	std::vector<Tile> selection;
+	int lakeGrid;			// quads per side of tiles with a lake, the terrain grid density rounded up to a power of two
+	int gridOffset[8], gridCount[8], gridBase[8];		// index range and first vertex per power of two
+	Frustum frustum;
+
+	static int log2i(int n) {
+		int k = 0;
+		while ((1 << k) < n) k++;
+		return k;
+	}
+
+	// Terrain and lake bounds of the tiles from the texels under them, and one texel around them so
+	// that waves pushing a tile edge sideways stay over the bounds
+	void buildBounds(TerrainTexture* _texture) {
+		texture = _texture;
+		texture->download();
+		const std::vector<vec4>& image = texture->getImage();
+		const std::vector<float>& lakes = texture->getLakeLevels();
+		int width = texture->getWidth(), height = texture->getHeight();
+		tileMin.assign(WATER_TILES * WATER_TILES, 1.0f);
+		tileLake.assign(WATER_TILES * WATER_TILES, 0.0f);
+		for (int ty = 0; ty < WATER_TILES; ty++) {
+			int y0 = max(0, ty * height / WATER_TILES - 1), y1 = min(height, (ty + 1) * height / WATER_TILES + 1);
+			for (int tx = 0; tx < WATER_TILES; tx++) {
+				int x0 = max(0, tx * width / WATER_TILES - 1), x1 = min(width, (tx + 1) * width / WATER_TILES + 1);
+				float& lo = tileMin[ty * WATER_TILES + tx];
+				float& lake = tileLake[ty * WATER_TILES + tx];
+				for (int y = y0; y < y1; y++) {
+					for (int x = x0; x < x1; x++) {
+						lo = min(lo, image[y * width + x].x);
+						if (!lakes.empty()) lake = max(lake, lakes[y * width + x]);
+					}
+				}
+			}
+		}
+	}
+
+public:
+	WaterGrid(Geometry* _plane, float _scale, int planeTesselation) {
+		plane = _plane;
+		scale = _scale;
+		lakeGrid = 1 << log2i(min(max(1, planeTesselation / WATER_TILES), WATER_MAX_GRID));		// tiles draw power of two grids
+		waterStats.planeVertices = (long long)(planeTesselation + 1) * (planeTesselation + 1);
+
+		// Grids of 1 to WATER_MAX_GRID quads per side over [0, 1]^2, one after the other
+		std::vector<VertexData> vtxData;
+		std::vector<unsigned int> idxData;
+		for (int k = 0; (1 << k) <= WATER_MAX_GRID; k++) {
+			int N = 1 << k;
+			gridBase[k] = (int)vtxData.size();
+			gridOffset[k] = (int)idxData.size();
+			for (int i = 0; i <= N; i++) {
+				for (int j = 0; j <= N; j++) {
+					VertexData vd;
+					vd.tex = vec2((float)j / N, (float)i / N);
+					vd.pos = vec3(vd.tex.x, 0, vd.tex.y);
+					vtxData.push_back(vd);
+				}
+			}
+			for (int i = 0; i < N; i++) {
+				for (int j = 0; j < N; j++) {
+					unsigned int a = i * (N + 1) + j;
+					idxData.insert(idxData.end(), { a, a + N + 1, a + 1, a + 1, a + N + 1, a + N + 2 });
+				}
+			}
+			gridCount[k] = (int)idxData.size() - gridOffset[k];
+		}
+
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, vtxData.size() * sizeof(VertexData), vtxData.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, idxData.size() * sizeof(unsigned int), idxData.data(), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0); // AttArr 0 = POSITION
+		glEnableVertexAttribArray(1); // AttArr 1 = UV
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)offsetof(VertexData, pos));
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)offsetof(VertexData, tex));
+	}
+
+	// Once per frame before drawing, picks the tiles and their grids
+	void select(const RenderState& state) {
+		if (!waterTiles) return;
+		auto start = std::chrono::high_resolution_clock::now();
+		if (state.terrainTexture != texture) buildBounds(state.terrainTexture);
+		frustum.update(state.V, state.P);
+
+		float tileSize = scale / WATER_TILES;
+		float waveMargin = 2.0f * state.waveAmplitude;
+		float spacing = state.waveLength / max(1, waterQuadsPerWave);
+		int nearGrid = 1 << min(log2i((int)ceilf(tileSize / max(spacing, 0.001f))), log2i(WATER_MAX_GRID));
+
+		selection.clear();
+		tileGrid.assign(WATER_TILES * WATER_TILES, 0);
+		waterStats.tiles = 0;
+		for (int ty = 0; ty < WATER_TILES; ty++) {
+			for (int tx = 0; tx < WATER_TILES; tx++) {
+				int tile = ty * WATER_TILES + tx;
+				float surface = max(state.waterLevel, tileLake[tile]) * terrainAmplitude;
+				if (tileMin[tile] * terrainAmplitude >= surface + waveMargin) continue;
+				waterStats.tiles++;
+
+				float lo = state.waterLevel * terrainAmplitude - waveMargin;
+				vec3 center((tx + 0.5f) * tileSize - 0.5f * scale, 0.5f * (lo + surface + waveMargin), (ty + 0.5f) * tileSize - 0.5f * scale);
+				vec3 extent(0.5f * tileSize + waveMargin, 0.5f * (surface + waveMargin - lo), 0.5f * tileSize + waveMargin);
+				int planeMask = FRUSTUM_ALL_PLANES;
+				if (terrainCulling && frustum.test(center, extent, planeMask) == FRUSTUM_OUTSIDE) continue;
+
+				float dx = max(fabsf(state.wEye.x - center.x) - 0.5f * tileSize, 0.0f);
+				float dz = max(fabsf(state.wEye.z - center.z) - 0.5f * tileSize, 0.0f);
+				float distance = length(vec3(dx, state.wEye.y - center.y, dz)) / (WATER_LOD_DISTANCE * tileSize);
+				int level = distance > 1.0f ? (int)log2f(distance) + 1 : 0;
+				tileGrid[tile] = max(1, nearGrid >> level);
+				// The lake surface steps between texels and is only raised at vertices inside the lake
+				if (tileLake[tile] > state.waterLevel) tileGrid[tile] = max(tileGrid[tile], lakeGrid);
+				selection.push_back({ tx, ty, tileGrid[tile] });
+			}
+		}
+		waterStats.visible = (int)selection.size();
+		waterStats.selectMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	void Draw(Shader& shader) {
+		setProgramUniform(shader, "waterTile", waterTiles ? 1 : 0);
+		if (!waterTiles) {
+			plane->Draw(shader);
+			waterStats.vertices = waterStats.planeVertices;
+			return;
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		setProgramUniform(shader, "vertexPulling", 0);
+		setProgramUniform(shader, "lodPatch", 0);
+		setProgramUniform(shader, "vertexGrid", 0);
+		setProgramUniform(shader, "gridScale", scale);
+		int rectLocation = shader.uniformLocation("tileRect");
+		int gridLocation = shader.uniformLocation("tileGrid");
+		int snapLocation = shader.uniformLocation("tileSnap");
+
+		float tileSize = scale / WATER_TILES;
+		auto neighbour = [&](int x, int y, int grid) {
+			if (x < 0 || y < 0 || x >= WATER_TILES || y >= WATER_TILES) return 1;
+			int other = tileGrid[y * WATER_TILES + x];
+			return other == 0 ? 1 : max(1, grid / other);
+		};
+
+		glBindVertexArray(vao);
+		waterStats.vertices = 0;
+		for (const Tile& tile : selection) {
+			int k = log2i(tile.grid);
+			glUniform3f(rectLocation, tile.x * tileSize - 0.5f * scale, tile.y * tileSize - 0.5f * scale, tileSize);
+			glUniform1i(gridLocation, tile.grid);
+			glUniform4i(snapLocation, neighbour(tile.x - 1, tile.y, tile.grid), neighbour(tile.x + 1, tile.y, tile.grid),
+				neighbour(tile.x, tile.y - 1, tile.grid), neighbour(tile.x, tile.y + 1, tile.grid));
+			glDrawElementsBaseVertex(GL_TRIANGLES, gridCount[k], GL_UNSIGNED_INT, (void*)(gridOffset[k] * sizeof(unsigned int)), gridBase[k]);
+			geometryStats.drawCalls++;
+			geometryStats.triangles += gridCount[k] / 3;
+			waterStats.vertices += (long long)(tile.grid + 1) * (tile.grid + 1);
+		}
+		geometryStats.drawMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+};
@@ -10,20 +10,22 @@ class WaterShader : public Shader {
 		#version 450 core
 		precision highp float;
 
-		struct Light {
-			vec3 La, Le;
-			vec4 wLightPos;
-		};
+		#include <uniformblocks>
 		
-		uniform float terrainAmplitude;
-		uniform float waterLevel;
-		uniform float waveLength;
-		uniform float waveAmplitude;
-		uniform float time;						// Current time in ms
-		uniform mat4  MVP, M;					// MVP, Model
-		uniform Light[8] lights;				// Light sources 
-		uniform int   nLights;
-		uniform vec3  wEye;						// Eye position
+		layout(binding = 1) uniform sampler2D lakeLevel;			// per texel lake surface, 0 outside lakes
+		layout(binding = 0) uniform sampler2D terrainTexture;		// morph distance of LOD patches, as on the terrain
+		uniform int   vertexPulling;		// grid from gl_VertexID and gl_InstanceID instead of the vertex buffer
+		uniform int   gridTesselation;
+		uniform float gridScale;
+		uniform int   lodPatch;			// CDLOD patch from the grid point in [0, 1]
+		uniform vec3  patchRect;		// patch corner x, z and size
+		uniform vec2  morphRange;		// distance where morphing into the coarser level starts and ends
+		uniform int   patchGridDim;
+		uniform int   vertexGrid;		// vtxUV is a grid point of a grid this many quads wide, vtxPos unused
+		uniform int   waterTile;		// water tile from vtxUV in [0, 1]
+		uniform vec3  tileRect;			// tile corner x, z and size
+		uniform int   tileGrid;			// quads per tile side
+		uniform ivec4 tileSnap;			// grid ratio to the neighbour at x = 0, x = 1, z = 0, z = 1
 
 		layout(location = 0) in vec3  vtxPos;   // pos in modeling space
 		layout(location = 1) in vec2  vtxUV;
@@ -32,6 +34,8 @@ class WaterShader : public Shader {
 		out vec3 wLight[8];						// light dir in world space
 		out vec2 texcoord;
 		out float distance;						// Distance from camera
+		out float surfaceLevel;					// normalized water surface height
+		out vec2 wavePos;						// before the wave offset
 
 		vec3 waveOffset(vec3 vertex) {
 			float x = (vertex.x / waveLength + time / 10000.0) * 2.0 * 3.1415;
@@ -41,8 +45,40 @@ class WaterShader : public Shader {
 		}
 		
 		void main() {
+			vec2 gridUV = vtxUV;
 			vec3 vertexPos = vtxPos;
-			vertexPos.y = waterLevel * terrainAmplitude;
+			if (vertexGrid != 0) {
+				gridUV = vtxUV / float(vertexGrid);
+				vertexPos = vec3((gridUV.x - 0.5) * gridScale, 0.0, (gridUV.y - 0.5) * gridScale);
+			}
+			vec2 uv = gridUV;
+			if (vertexPulling != 0) {
+				uv = vec2(gl_VertexID >> 1, gl_InstanceID + (gl_VertexID & 1)) / float(gridTesselation);
+				vertexPos = vec3((uv.x - 0.5) * gridScale, 0.0, (uv.y - 0.5) * gridScale);
+			}
+			else if (lodPatch != 0) {
+				vec2 world = patchRect.xy + gridUV * patchRect.z;
+				float h = texture(terrainTexture, world / gridScale + 0.5).r * terrainAmplitude;
+				float morph = clamp((length(vec3(world.x, h, world.y) - wEye) - morphRange.x) / (morphRange.y - morphRange.x), 0.0, 1.0);
+				vec2 local = gridUV - fract(gridUV * float(patchGridDim) * 0.5) * 2.0 / float(patchGridDim) * morph;
+				world = patchRect.xy + local * patchRect.z;
+				uv = world / gridScale + 0.5;
+				vertexPos = vec3(world.x, 0.0, world.y);
+			}
+			else if (waterTile != 0) {
+				// Edge vertices between those of a coarser neighbour move onto them
+				ivec2 g = ivec2(round(gridUV * float(tileGrid)));
+				if (g.x == 0) g.y = g.y / tileSnap.x * tileSnap.x;
+				if (g.x == tileGrid) g.y = g.y / tileSnap.y * tileSnap.y;
+				if (g.y == 0) g.x = g.x / tileSnap.z * tileSnap.z;
+				if (g.y == tileGrid) g.x = g.x / tileSnap.w * tileSnap.w;
+				vec2 world = tileRect.xy + vec2(g) / float(tileGrid) * tileRect.z;
+				uv = world / gridScale + 0.5;
+				vertexPos = vec3(world.x, 0.0, world.y);
+			}
+			surfaceLevel = max(waterLevel, texture(lakeLevel, uv).r);
+			vertexPos.y = surfaceLevel * terrainAmplitude;
+			wavePos = vertexPos.xz;
 			vertexPos = waveOffset(vertexPos);
 			gl_Position = vec4(vertexPos, 1) * MVP; // to NDC
 			vec4 wPos = vec4(vertexPos, 1) * M;
@@ -50,7 +86,7 @@ class WaterShader : public Shader {
 				wLight[i] = lights[i].wLightPos.xyz * wPos.w - wPos.xyz * lights[i].wLightPos.w;
 			}
 		    wView  = wEye * wPos.w - wPos.xyz;
-		    texcoord = vtxUV;
+		    texcoord = uv;
 			distance = length(wPos.xyz - wEye);
 		}
 	)";
@@ -59,29 +95,18 @@ class WaterShader : public Shader {
 	#version 450 core
 	precision highp float;
 
-	struct Light {
-		vec3 La, Le;
-		vec4 wLightPos;
-	};
-
-	struct Material {
-		vec3 kd, ks, ka;
-		float shininess;
-	};
+	#include <uniformblocks>
 
-	uniform float waterLevel;
-	uniform float waterAlpha;
-	uniform float time;
 	uniform vec3 waterColor;
-	uniform Material material;
-	uniform Light[8] lights;
-	uniform int   nLights;
-	uniform sampler2D terrainTexture;
+	layout(binding = 0) uniform sampler2D terrainTexture;
+	layout(binding = 3) uniform sampler2D terrainNormals;	// height gradient per texture coordinate
 
 	in  vec3 wView;						// interpolated world sp view
 	in  vec3 wLight[8];					// interpolated world sp illum dir
 	in  vec2 texcoord;
 	in float distance;					
+	in float surfaceLevel;
+	in vec2 wavePos;
 	
 	out vec4 fragmentColor;				// output goes to frame buffer
 
@@ -89,16 +114,21 @@ class WaterShader : public Shader {
 	vec3 foamColor = vec3(1.0, 1.0, 1.0);
 	
 	void main() {
-		vec3 xTangent = dFdx(wView);
-		vec3 yTangent = dFdy(wView);
-		vec3 N = normalize(cross(xTangent, yTangent));
+		// Normal of the waves, waveOffset moves x, y and z by the same offset
+		float x = (wavePos.x / waveLength + time / 10000.0) * 2.0 * 3.1415;
+		float z = (wavePos.y / waveLength + time / 10000.0) * 2.0 * 3.1415;
+		float dx = cos(x) * 2.0 * 3.1415 / waveLength * waveAmplitude;
+		float dz = -sin(z) * 2.0 * 3.1415 / waveLength * waveAmplitude;
+		vec3 N = normalize(vec3(-dx, 1.0 + dx + dz, -dz));
 		vec3 V = normalize(wView); 
 		
 		float aplha = waterAlpha;
 		float terrainHeight = texture(terrainTexture, texcoord).r;
-		float waterDepth = waterLevel - terrainHeight;
+		float waterDepth = surfaceLevel - terrainHeight;
 		
-		float epsilon = 0.05;
+		float epsilon = surfaceLevel > waterLevel ? 0.005 : 0.05;		// lakes are shallow, keep their foam line thin
+		// On flat shores the same depth reaches much further out, narrow the band there
+		epsilon *= clamp(length(texture(terrainNormals, texcoord).rg) * slopeScale, 0.25, 1.0);
 		if(abs(waterDepth) < epsilon) {
 			float foamFactor = abs(waterDepth) / epsilon;
 			texColor = mix(foamColor, texColor, foamFactor);
@@ -127,23 +157,12 @@ public:
 		create(vertexSource, fragmentSource, "fragmentColor");
 	}
 
+	// Everything else is in the uniform blocks
 	void Bind(RenderState state) {
 		Use();
 
-		setUniform(*state.terrainTexture, std::string("terrainTexture"));
-		setUniform(terrainAmplitude, "terrainAmplitude");
-		setUniform(state.waterLevel, "waterLevel");
-		setUniform(state.waveLength, "waveLength");
-		setUniform(state.waveAmplitude, "waveAmplitude");
-		setUniform(state.waterAlpha, "waterAlpha");
-		setUniform(state.time, "time");
-		setUniform(state.MVP, "MVP");
-		setUniform(state.M, "M");
-		setUniform(state.wEye, "wEye");
-		setUniformMaterial(*state.material, "material");
-		setUniform((int)state.lights.size(), "nLights");
-		for (unsigned int i = 0; i < state.lights.size(); i++) {
-			setUniformLight(state.lights[i], std::string("lights[") + std::to_string(i) + std::string("]"));
-		}
+		glBindTextureUnit(0, state.terrainTexture->textureId);
+		glBindTextureUnit(1, state.terrainTexture->lakeLevelTextureId);
+		glBindTextureUnit(3, state.terrainTexture->normalTextureId);
 	}
-};
+};
\ No newline at end of file